@@ -0,0 +1,79 @@
+#include "../common/logging.h"
+#include "../common/resolver_cache.h"
+#include <asio.hpp>
+#include <chrono>
+#include <string>
+#include <thread>
+
+// Checks that the ResolverCache answers repeated lookups from its cache, for successful and failed lookups
+// alike, and that a failed lookup is retried once its negative TTL is over. Only names that resolve without
+// any DNS server are used: `localhost` and a name of the reserved `.invalid` domain, which never resolves.
+// Exits with a non-zero status if a check fails.
+
+struct Result {
+  asio::error_code m_ec;
+  ResolverCache::Endpoints m_endpoints;
+};
+
+// Resolves the name and runs the io_service until the handler has been called.
+Result Resolve(asio::io_service& ios, ResolverCache& resolver, const std::string& host) {
+  Result result;
+  resolver.AsyncResolve(host, "3333",
+                        [&result](const asio::error_code& ec, ResolverCache::Endpoints endpoints) {
+                          result.m_ec = ec;
+                          result.m_endpoints = endpoints;
+                        });
+
+  ios.reset();
+  ios.run();
+  return result;
+}
+
+int main() {
+  auto console = logging::setup();
+  int failures = 0;
+
+  auto check = [&console, &failures](bool condition, const char* what) {
+    if (condition) {
+      console->info("PASS: {}", what);
+    } else {
+      console->error("FAIL: {}", what);
+      ++failures;
+    }
+  };
+
+  asio::io_service ios;
+
+  ResolverCache::Config config;
+  config.negative_ttl = std::chrono::milliseconds(500);
+  ResolverCache resolver(ios, config);
+
+  // A name resolved twice is only looked up once, the second call gets the very same endpoints.
+  Result first = Resolve(ios, resolver, "localhost");
+  check(!first.m_ec && first.m_endpoints && !first.m_endpoints->empty(), "localhost resolves");
+  check(resolver.GetStats().lookups == 1, "the first call looks localhost up");
+
+  Result second = Resolve(ios, resolver, "localhost");
+  check(resolver.GetStats().lookups == 1 && resolver.GetStats().hits == 1,
+        "the second call is answered from the cache");
+  check(second.m_endpoints == first.m_endpoints, "the cached endpoints are shared, not copied");
+
+  // A name that does not resolve is cached as a failure until its negative TTL is over.
+  const std::string bogus = "no-such-host.invalid";
+  Result failed = Resolve(ios, resolver, bogus);
+  check(static_cast<bool>(failed.m_ec), "the bogus name fails to resolve");
+  check(resolver.GetStats().lookups == 2, "the first call looks the bogus name up");
+
+  Result cached_failure = Resolve(ios, resolver, bogus);
+  check(cached_failure.m_ec == failed.m_ec && resolver.GetStats().lookups == 2 &&
+            resolver.GetStats().hits == 2,
+        "the failure is answered from the cache");
+
+  std::this_thread::sleep_for(config.negative_ttl + std::chrono::milliseconds(100));
+  Result retried = Resolve(ios, resolver, bogus);
+  check(static_cast<bool>(retried.m_ec) && resolver.GetStats().lookups == 3,
+        "the bogus name is looked up again once the negative TTL is over");
+
+  console->info("{} check(s) failed.", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+#define RECIPE_NO_MAIN
+#include "../ch03/04_Async_tcp_client_mt.cpp"
+#include "allocation_counter.h"
+#include "loopback_server.h"
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Counts the heap allocations made while the multithreaded asynchronous client serves requests. Once the
+// client is warm (its sessions, pooled connections and buffers exist), a request must not allocate: the
+// session is recycled, its operations are allocated from the session's memory and its buffers keep their
+// capacity. The allocations of the loopback server are not counted. Exits with a non-zero status if a
+// request allocates after warm-up.
+
+const unsigned int WARM_UP_REQUESTS = 1000;
+const unsigned int MEASURED_REQUESTS = 10000;
+
+// Sends `count` requests one after another and waits for each to complete. Returns the number of requests
+// that failed.
+unsigned int RunRequests(AsyncTCPClient& client, unsigned short port, unsigned int first_id,
+                         unsigned int count) {
+  std::atomic<unsigned int> completed{0};
+  std::atomic<unsigned int> failed{0};
+
+  for (unsigned int i = 0; i < count; ++i) {
+    auto on_complete = [&completed, &failed](unsigned int, FrameView, const asio::error_code& ec) {
+      if (ec) failed.fetch_add(1, std::memory_order_relaxed);
+      completed.fetch_add(1, std::memory_order_release);
+    };
+    client.emulateLongComputationOp(0, "127.0.0.1", port, on_complete, first_id + i);
+
+    while (completed.load(std::memory_order_acquire) != i + 1) std::this_thread::yield();
+  }
+
+  return failed.load();
+}
+
+// Returns true if no request allocated after warm-up.
+bool Measure(const char* mode, ClientConfig config, unsigned short port) {
+  auto console = logging::get();
+
+  AsyncTCPClient client{4, config};
+  unsigned int failed = RunRequests(client, port, 1, WARM_UP_REQUESTS);
+
+  std::uint64_t before = g_allocations.load();
+  failed += RunRequests(client, port, WARM_UP_REQUESTS + 1, MEASURED_REQUESTS);
+  std::uint64_t allocations = g_allocations.load() - before;
+
+  client.close();
+
+  console->info("{}: {} allocations in {} requests after warm-up, {} failed requests.", mode, allocations,
+                MEASURED_REQUESTS, failed);
+  return allocations == 0 && failed == 0;
+}
+
+int main() {
+  auto console = logging::setup();
+
+  LoopbackServer server{[]() { t_uncounted = true; }};
+
+  ClientConfig text;
+  ClientConfig binary;
+  binary.protocol = WireProtocol::Binary;
+  ClientConfig multiplexed;
+  multiplexed.multiplexed_connections = 2;
+
+  bool ok = Measure("text", text, server.Port());
+  ok = Measure("binary", binary, server.Port()) && ok;
+  ok = Measure("multiplexed", multiplexed, server.Port()) && ok;
+
+  server.Stop();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#include "../common/arena.h"
+#include "../common/logging.h"
+#include "allocation_counter.h"
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Counts the heap allocations of the transient strings of a request, which the servers allocate in a
+// per-request arena taken from the ArenaCache. The request goes through the same steps as in the asynchronous
+// server: copied out of the receive buffer into the arena, moved into the compute task, processed into a
+// response allocated in the arena, moved back to the connection and the arena recycled once the response is
+// sent. The requests have several sizes, the largest ones spill over the first block of the arena. Once the
+// cached arenas have grown to fit them, a request must not allocate. The same steps with std::string are
+// counted as a baseline. Exits with a non-zero status if a request allocates after warm-up.
+
+const unsigned int WARM_UP_REQUESTS = 1000;
+const unsigned int MEASURED_REQUESTS = 100000;
+
+// Requests of the sample protocol, padded to a few sizes. They are all too long for the small string
+// optimization, so every copy of them needs memory.
+std::vector<std::string> MakeRequests() {
+  std::vector<std::string> requests;
+  for (std::size_t padding : {0, 100, 1000, 4000}) {
+    requests.push_back("EMULATE_LONG_COMP_OP 10" + std::string(padding, ' '));
+  }
+  return requests;
+}
+
+// Builds a response echoing the request, as large as the request. Stands for the parse results and other
+// transient data of the processing.
+template <typename String>
+String ProcessRequest(const String& request) {
+  String response{request.get_allocator()};
+  response.reserve(request.size() + 9);
+  response.append("Response ").append(request);
+  return response;
+}
+
+// Returns the number of bytes of the responses, so that the work cannot be optimized away.
+std::size_t ServeWithArena(const std::vector<std::string>& requests, unsigned int count) {
+  std::size_t total = 0;
+  for (unsigned int i = 0; i < count; ++i) {
+    const std::string& frame = requests[i % requests.size()];
+
+    PooledArena arena = ArenaCache::Acquire();
+    ArenaString request{frame.data(), frame.size(), ArenaAllocator<char>{*arena}};
+    ArenaString task_request{std::move(request)};
+    ArenaString response = ProcessRequest(ArenaString{std::move(task_request)});
+    ArenaString sent{std::move(response)};
+    total += sent.size();
+  }
+  return total;
+}
+
+std::size_t ServeWithHeap(const std::vector<std::string>& requests, unsigned int count) {
+  std::size_t total = 0;
+  for (unsigned int i = 0; i < count; ++i) {
+    const std::string& frame = requests[i % requests.size()];
+
+    std::string request{frame.data(), frame.size()};
+    std::string task_request{std::move(request)};
+    std::string response = ProcessRequest(std::string{std::move(task_request)});
+    std::string sent{std::move(response)};
+    total += sent.size();
+  }
+  return total;
+}
+
+template <typename Serve>
+std::uint64_t Measure(const char* mode, const std::vector<std::string>& requests, Serve serve) {
+  auto console = logging::get();
+
+  std::size_t bytes = serve(requests, WARM_UP_REQUESTS);
+  std::uint64_t before = g_allocations.load();
+  bytes += serve(requests, MEASURED_REQUESTS);
+  std::uint64_t allocations = g_allocations.load() - before;
+
+  console->info("{}: {} allocations in {} requests after warm-up ({} bytes answered).", mode, allocations,
+                MEASURED_REQUESTS, bytes);
+  return allocations;
+}
+
+int main() {
+  auto console = logging::setup();
+  std::vector<std::string> requests = MakeRequests();
+
+  std::uint64_t heap = Measure("std::string", requests, ServeWithHeap);
+  std::uint64_t arena = Measure("arena", requests, ServeWithArena);
+
+  // The baseline allocating proves that the allocations are counted at all.
+  bool ok = heap != 0 && arena == 0;
+  if (!ok) console->error("FAIL: the transient strings of a request allocate from the heap.");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+#include "../common/logging.h"
+#include "../common/sharded_map.h"
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Measures the throughput of the registry of active sessions of the multithreaded asynchronous client as the
+// number of threads using it grows from 1 to 64. Every thread runs the life of requests of its own: insert
+// the session when the request starts, look it up as a cancellation would, erase it when the request
+// completes. The ShardedMap the client uses is compared with the registry it replaced, a std::map behind a
+// single mutex. Exits with a non-zero status if a registry is not empty once all the requests are over.
+
+const unsigned int REQUESTS = 1 << 21;  // Shared by all the threads of a run.
+
+struct Session {
+  bool m_was_cancelled = false;
+};
+
+// The registry as it was before sharding.
+class LockedMap {
+public:
+  void Insert(unsigned int key, std::shared_ptr<Session> value) {
+    std::unique_lock<std::mutex> lock{m_guard};
+    m_items[key] = std::move(value);
+  }
+
+  bool Erase(unsigned int key) {
+    std::unique_lock<std::mutex> lock{m_guard};
+    return m_items.erase(key) != 0;
+  }
+
+  template <typename Visitor>
+  bool Visit(unsigned int key, Visitor visitor) {
+    std::unique_lock<std::mutex> lock{m_guard};
+
+    auto it = m_items.find(key);
+    if (it == m_items.end()) return false;
+
+    visitor(it->second);
+    return true;
+  }
+
+  std::size_t Size() const {
+    std::unique_lock<std::mutex> lock{m_guard};
+    return m_items.size();
+  }
+
+private:
+  std::map<unsigned int, std::shared_ptr<Session>> m_items;
+  mutable std::mutex m_guard;
+};
+
+// Runs REQUESTS requests split between `num_threads` threads. Returns the number of operations (insert,
+// visit and erase) per second.
+template <typename Map>
+double Run(Map& registry, unsigned int num_threads) {
+  unsigned int per_thread = REQUESTS / num_threads;
+  std::vector<std::thread> threads;
+
+  auto started = std::chrono::steady_clock::now();
+  for (unsigned int t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&registry, t, num_threads, per_thread]() {
+      auto session = std::make_shared<Session>();
+
+      // The ids of the threads interleave, as those handed out by the client to its callers do.
+      for (unsigned int i = 0; i < per_thread; ++i) {
+        unsigned int id = i * num_threads + t;
+        registry.Insert(id, session);
+        registry.Visit(id, [](std::shared_ptr<Session>& s) { s->m_was_cancelled = true; });
+        registry.Erase(id);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+  return 3.0 * per_thread * num_threads / elapsed.count();
+}
+
+int main() {
+  auto console = logging::setup();
+  console->info("{} hardware threads.", std::thread::hardware_concurrency());
+
+  bool ok = true;
+  for (unsigned int num_threads = 1; num_threads <= 64; num_threads *= 2) {
+    LockedMap locked;
+    double locked_ops = Run(locked, num_threads);
+
+    ShardedMap<unsigned int, std::shared_ptr<Session>> sharded;
+    double sharded_ops = Run(sharded, num_threads);
+
+    console->info("{:>2} threads: std::map + mutex {:>6.2f} Mops/s, ShardedMap {:>6.2f} Mops/s ({:.1f}x)",
+                  num_threads, locked_ops / 1e6, sharded_ops / 1e6, sharded_ops / locked_ops);
+    ok = ok && locked.Size() == 0 && sharded.Size() == 0;
+  }
+
+  if (!ok) console->error("FAIL: a registry is not empty once all the requests are over.");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,139 @@
+#include "../common/frame_reader.h"
+#include "../common/logging.h"
+#include <algorithm>
+#include <asio.hpp>
+#include <chrono>
+#include <cstring>
+#include <istream>
+#include <string>
+
+// Compares the framing of the text protocol through a FrameReader with the path it replaced: read_until
+// into an asio::streambuf, then std::getline through an std::istream. Both read the same stream of frames
+// from memory, handed out in segments of the size of a TCP segment, so only the framing is measured. Exits
+// with a non-zero status if the two paths do not see the same frames.
+
+const std::size_t STREAM_SIZE = 64 * 1024 * 1024;  // Bytes framed per run.
+const std::size_t SEGMENT_SIZE = 1448;             // Bytes returned by a read, a TCP segment's payload.
+
+// Synchronous read stream over a string, returning at most SEGMENT_SIZE bytes per read. The end of the
+// string is reported as asio::error::eof.
+class MemoryStream {
+public:
+  explicit MemoryStream(const std::string& data) : m_data(data), m_offset{0} {}
+
+  template <typename MutableBufferSequence>
+  std::size_t read_some(const MutableBufferSequence& buffers, asio::error_code& ec) {
+    if (m_offset == m_data.size()) {
+      ec = asio::error::eof;
+      return 0;
+    }
+
+    ec = asio::error_code();
+    std::size_t size = std::min(SEGMENT_SIZE, m_data.size() - m_offset);
+    size = asio::buffer_copy(buffers, asio::buffer(m_data.data() + m_offset, size));
+    m_offset += size;
+    return size;
+  }
+
+  template <typename MutableBufferSequence>
+  std::size_t read_some(const MutableBufferSequence& buffers) {
+    asio::error_code ec;
+    std::size_t size = read_some(buffers, ec);
+    if (ec) throw asio::system_error(ec);
+    return size;
+  }
+
+private:
+  const std::string& m_data;
+  std::size_t m_offset;
+};
+
+// Result of framing a whole stream: the number of frames and a checksum of their contents.
+struct Framed {
+  std::size_t m_frames = 0;
+  std::size_t m_checksum = 0;
+
+  void Add(const char* data, std::size_t size) {
+    ++m_frames;
+    m_checksum = m_checksum * 31 + size;
+    if (size == 0) return;
+    m_checksum += static_cast<unsigned char>(data[0]) + static_cast<unsigned char>(data[size - 1]);
+  }
+};
+
+Framed FrameWithStreambuf(const std::string& data) {
+  MemoryStream stream{data};
+  asio::streambuf buf;
+  Framed framed;
+
+  for (;;) {
+    asio::error_code ec;
+    asio::read_until(stream, buf, '\n', ec);
+    if (ec) break;
+
+    std::istream input(&buf);
+    std::string frame;
+    std::getline(input, frame);
+    framed.Add(frame.data(), frame.size());
+  }
+  return framed;
+}
+
+Framed FrameWithFrameReader(const std::string& data) {
+  MemoryStream stream{data};
+  FrameReader reader;
+  Framed framed;
+
+  try {
+    for (;;) {
+      FrameView frame = ReadFrame(stream, reader);
+      framed.Add(frame.data, frame.size);
+    }
+  } catch (asio::system_error&) {
+    // The end of the stream.
+  }
+  return framed;
+}
+
+// Returns the throughput of `frame` over `data` in MB/s.
+template <typename Frame>
+double Measure(Frame frame, const std::string& data, Framed& framed) {
+  auto started = std::chrono::steady_clock::now();
+  framed = frame(data);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+  return data.size() / elapsed.count() / 1e6;
+}
+
+int main() {
+  auto console = logging::setup();
+  bool ok = true;
+
+  for (std::size_t frame_size : {24, 128, 1024, 16384}) {
+    // Frames of the given size, the last byte being the delimiter.
+    std::string frame(frame_size - 1, 'x');
+    std::memcpy(&frame[0], "EMULATE_LONG_COMP_OP 10", std::min<std::size_t>(frame.size(), 23));
+    frame += '\n';
+
+    std::string data;
+    data.reserve(STREAM_SIZE);
+    while (data.size() + frame.size() <= STREAM_SIZE) data += frame;
+
+    Framed streambuf_framed;
+    Framed reader_framed;
+    double streambuf_rate = Measure(FrameWithStreambuf, data, streambuf_framed);
+    double reader_rate = Measure(FrameWithFrameReader, data, reader_framed);
+
+    console->info("{:>5} byte frames: streambuf + getline {:>7.1f} MB/s, FrameReader {:>7.1f} MB/s ({:.1f}x)",
+                  frame_size, streambuf_rate, reader_rate, reader_rate / streambuf_rate);
+
+    if (streambuf_framed.m_frames != data.size() / frame.size() ||
+        reader_framed.m_frames != streambuf_framed.m_frames ||
+        reader_framed.m_checksum != streambuf_framed.m_checksum) {
+      console->error("FAIL: the two paths framed {} and {} frames of {} bytes differently.",
+                     streambuf_framed.m_frames, reader_framed.m_frames, frame_size);
+      ok = false;
+    }
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+#include "../common/datagram_batch.h"
+#include "../common/logging.h"
+#include <asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+// Measures the datagrams per second moved over loopback with one system call per datagram (send_to and
+// receive_from) and with a DatagramBatch (sendmmsg and recvmmsg on Linux) of several sizes. A single thread
+// sends a burst of datagrams from one socket to another and then receives all of them: the bursts fit in the
+// receive buffer of the socket, so no datagram is dropped and every one of them is checked. Exits with a
+// non-zero status if a datagram is lost, duplicated or reordered.
+
+const std::size_t DATAGRAM_SIZE = 64;
+const std::size_t DATAGRAMS = 1 << 18;  // Sent per run.
+
+class Loopback {
+public:
+  Loopback()
+      : m_sender{m_ios, asio::ip::udp::endpoint{asio::ip::address_v4::loopback(), 0}},
+        m_receiver{m_ios, asio::ip::udp::endpoint{asio::ip::address_v4::loopback(), 0}},
+        m_destination{m_receiver.local_endpoint()},
+        m_next_sent{0},
+        m_next_received{0},
+        m_errors{0} {}
+
+  // Sends and receives DATAGRAMS datagrams in bursts of `burst`, one system call per datagram.
+  void RunSingle(std::size_t burst) {
+    char payload[DATAGRAM_SIZE] = {};
+    asio::ip::udp::endpoint sender;
+
+    while (m_next_sent < DATAGRAMS) {
+      for (std::size_t i = 0; i < burst; ++i) {
+        std::memcpy(payload, &m_next_sent, sizeof(m_next_sent));
+        m_sender.send_to(asio::buffer(payload), m_destination);
+        ++m_next_sent;
+      }
+
+      for (std::size_t i = 0; i < burst; ++i) {
+        std::size_t size = m_receiver.receive_from(asio::buffer(payload), sender);
+        Check(payload, size);
+      }
+    }
+  }
+
+  // Same with the bursts sent and received through batches of `burst` datagrams.
+  void RunBatched(std::size_t burst) {
+    DatagramBatch outgoing{burst, DATAGRAM_SIZE};
+    DatagramBatch incoming{burst, DATAGRAM_SIZE};
+
+    while (m_next_sent < DATAGRAMS) {
+      outgoing.Clear();
+      for (std::size_t i = 0; i < burst; ++i) {
+        char* payload = outgoing.Add(m_destination);
+        std::memset(payload, 0, DATAGRAM_SIZE);
+        std::memcpy(payload, &m_next_sent, sizeof(m_next_sent));
+        outgoing.Resize(i, DATAGRAM_SIZE);
+        ++m_next_sent;
+      }
+      SendDatagrams(m_sender, outgoing);
+
+      // A receive returns what is already queued, which may be less than the whole burst.
+      std::size_t received = 0;
+      while (received < burst) {
+        ReceiveDatagrams(m_receiver, incoming);
+        for (std::size_t i = 0; i < incoming.Size(); ++i) Check(incoming.Data(i), incoming.Size(i));
+        received += incoming.Size();
+      }
+    }
+  }
+
+  // Number of datagrams that were not the one expected.
+  std::uint64_t Errors() const { return m_errors + (m_next_received != DATAGRAMS ? 1 : 0); }
+
+private:
+  void Check(const char* payload, std::size_t size) {
+    std::uint64_t seq;
+    std::memcpy(&seq, payload, sizeof(seq));
+    if (size != DATAGRAM_SIZE || seq != m_next_received) ++m_errors;
+    ++m_next_received;
+  }
+
+private:
+  asio::io_service m_ios;
+  asio::ip::udp::socket m_sender;
+  asio::ip::udp::socket m_receiver;
+  asio::ip::udp::endpoint m_destination;
+  std::uint64_t m_next_sent;
+  std::uint64_t m_next_received;
+  std::uint64_t m_errors;
+};
+
+// Returns the datagrams per second of `run`, counting the errors in `errors`.
+template <typename Run>
+double Measure(Run run, std::uint64_t& errors) {
+  Loopback loopback;
+  auto started = std::chrono::steady_clock::now();
+  run(loopback);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+  errors += loopback.Errors();
+  return DATAGRAMS / elapsed.count();
+}
+
+int main() {
+  auto console = logging::setup();
+  std::uint64_t errors = 0;
+
+  for (std::size_t burst : {1, 8, 32, 64}) {
+    double single = Measure([burst](Loopback& loopback) { loopback.RunSingle(burst); }, errors);
+    double batched = Measure([burst](Loopback& loopback) { loopback.RunBatched(burst); }, errors);
+
+    console->info("bursts of {:>2}: send_to/receive_from {:>5.2f} Mpps, batched {:>5.2f} Mpps ({:.1f}x)",
+                  burst, single / 1e6, batched / 1e6, batched / single);
+  }
+
+  if (errors != 0) console->error("FAIL: {} datagram(s) lost, duplicated or reordered.", errors);
+  return errors == 0 ? 0 : 1;
+}
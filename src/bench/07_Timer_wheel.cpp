@@ -0,0 +1,107 @@
+#include "../common/logging.h"
+#include "../common/timer_wheel.h"
+#include <asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Measures the cost of the connection timeouts of the asynchronous server as the number of connections grows:
+// every connection has a timeout 30 seconds away, pushed back whenever the connection reads or writes. The
+// TimerWheel the server uses is compared with one asio::steady_timer per connection, whose re-arming cancels
+// the pending wait, queues its handler and starts a new wait. The io_service is polled after every round so
+// that the cost of the cancelled handlers is counted. Exits with a non-zero status if a timeout expires or
+// one is missing when they are all cancelled.
+
+typedef std::chrono::steady_clock Clock;
+
+const std::size_t REARMS = 1 << 21;  // Re-arms measured per run, spread over all the connections.
+const std::chrono::seconds TIMEOUT{30};
+
+// Deadline of connection `i`, jittered so that the timeouts do not all fall into the same place.
+Clock::time_point Deadline(Clock::time_point now, std::size_t i) {
+  return now + TIMEOUT + std::chrono::milliseconds(i % 1000);
+}
+
+// Returns the nanoseconds per re-arm, counting the failed checks in `errors`.
+double MeasureWheel(std::size_t connections, unsigned int& errors) {
+  asio::io_service ios;
+  TimerWheel wheel{ios, std::chrono::milliseconds(10)};
+
+  unsigned int expired = 0;
+  std::vector<std::unique_ptr<TimerWheel::Timer>> timers;
+  for (std::size_t i = 0; i < connections; ++i) {
+    timers.emplace_back(new TimerWheel::Timer{[&expired]() { ++expired; }});
+    wheel.Arm(*timers.back(), Deadline(Clock::now(), i));
+  }
+
+  auto started = Clock::now();
+  for (std::size_t done = 0; done < REARMS;) {
+    Clock::time_point now = Clock::now();
+    for (std::size_t i = 0; i < connections && done < REARMS; ++i, ++done) {
+      wheel.Arm(*timers[i], Deadline(now, i));
+    }
+    ios.poll();
+  }
+  std::chrono::duration<double, std::nano> elapsed = Clock::now() - started;
+
+  std::size_t cancelled = 0;
+  for (auto& timer : timers) cancelled += wheel.Cancel(*timer) ? 1 : 0;
+  if (expired != 0 || cancelled != connections) ++errors;
+
+  return elapsed.count() / REARMS;
+}
+
+double MeasureSteadyTimers(std::size_t connections, unsigned int& errors) {
+  asio::io_service ios;
+
+  std::size_t expired = 0;
+  std::size_t aborted = 0;
+  auto on_wait = [&expired, &aborted](const asio::error_code& ec) {
+    if (ec == asio::error::operation_aborted) {
+      ++aborted;
+    } else {
+      ++expired;
+    }
+  };
+
+  std::vector<std::unique_ptr<asio::steady_timer>> timers;
+  for (std::size_t i = 0; i < connections; ++i) {
+    timers.emplace_back(new asio::steady_timer{ios});
+    timers.back()->expires_at(Deadline(Clock::now(), i));
+    timers.back()->async_wait(on_wait);
+  }
+
+  auto started = Clock::now();
+  for (std::size_t done = 0; done < REARMS;) {
+    Clock::time_point now = Clock::now();
+    for (std::size_t i = 0; i < connections && done < REARMS; ++i, ++done) {
+      timers[i]->expires_at(Deadline(now, i));
+      timers[i]->async_wait(on_wait);
+    }
+    ios.poll();
+  }
+  std::chrono::duration<double, std::nano> elapsed = Clock::now() - started;
+
+  for (auto& timer : timers) timer->cancel();
+  ios.poll();
+  if (expired != 0 || aborted != REARMS + connections) ++errors;
+
+  return elapsed.count() / REARMS;
+}
+
+int main() {
+  auto console = logging::setup();
+  unsigned int errors = 0;
+
+  for (std::size_t connections : {1000, 10000, 100000, 200000}) {
+    double wheel = MeasureWheel(connections, errors);
+    double steady_timers = MeasureSteadyTimers(connections, errors);
+
+    console->info("{:>6} connections: steady_timers {:>6.1f} ns, TimerWheel {:>6.1f} ns per re-arm ({:.1f}x)",
+                  connections, steady_timers, wheel, steady_timers / wheel);
+  }
+
+  if (errors != 0) console->error("FAIL: {} run(s) lost or expired a timeout.", errors);
+  return errors == 0 ? 0 : 1;
+}
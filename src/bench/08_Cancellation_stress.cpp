@@ -0,0 +1,213 @@
+#define RECIPE_NO_MAIN
+#include "../ch03/04_Async_tcp_client_mt.cpp"
+#include "../common/timer_wheel.h"
+#include "loopback_server.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Races the cancellation of client requests against their completion, to be run under ThreadSanitizer
+// (`make tsan`). First the RequestState machine alone: an I/O thread drives requests through their steps and
+// recycles their data, while one canceller cancels whatever request is current (as cancelRequest() does) and
+// another one holds on to generations that may be over (as an expired deadline does). The data of a request
+// is plain memory, so a canceller touching a request that has completed is a data race reported by TSan.
+// Then the multithreaded asynchronous client: every request to a loopback server is cancelled at some point,
+// while it connects, writes or reads, or just as it completes. Last, a TimerWheel whose io_service is run by
+// several threads, with callbacks slower than a tick so that the next tick runs on another thread while they
+// are being called. Exits with a non-zero status if a check fails.
+
+const unsigned int STATE_REQUESTS = 200000;
+const unsigned int CLIENT_REQUESTS = 2000;  // Per mode.
+const unsigned int WHEEL_TIMERS = 64;
+const unsigned int WHEEL_EXPIRIES = 50;  // Per timer.
+const unsigned int WHEEL_THREADS = 4;
+
+// Yields the thread 0 to 15 times, so that the moment of a cancellation varies. Returns the next state of the
+// generator.
+std::uint32_t YieldAWhile(std::uint32_t random) {
+  random = random * 1103515245 + 12345;
+  for (std::uint32_t i = (random >> 16) & 15; i != 0; --i) std::this_thread::yield();
+  return random;
+}
+
+// Data of a request, owned by the I/O thread and lent to the canceller that won the request.
+struct RequestData {
+  std::uint32_t m_generation = 0;
+  bool m_aborted = false;
+};
+
+// Returns the number of failed checks.
+unsigned int StressRequestState() {
+  auto console = logging::get();
+
+  RequestState state;
+  RequestData data;
+  std::atomic<std::uint32_t> published{0};  // Generation of the current request, read by the deadline.
+  std::atomic<bool> stop{false};
+  std::atomic<unsigned int> errors{0};
+  std::atomic<unsigned int> stale{0};
+
+  // Aborts the request won with BeginCancel(). It must be the current one.
+  auto abort = [&state, &data, &errors]() {
+    std::this_thread::yield();  // Aborting the operation takes a system call.
+    if (data.m_generation != state.Generation()) errors.fetch_add(1);
+    data.m_aborted = true;
+    state.EndCancel();
+  };
+
+  std::thread user{[&state, &stop, &abort]() {
+    std::uint32_t random = 1;
+    while (!stop.load(std::memory_order_relaxed)) {
+      random = YieldAWhile(random);
+      if (state.BeginCancel()) abort();
+    }
+  }};
+
+  std::thread deadline{[&state, &published, &stop, &stale, &abort]() {
+    std::uint32_t random = 2;
+    while (!stop.load(std::memory_order_relaxed)) {
+      std::uint32_t generation = published.load(std::memory_order_relaxed);
+      random = YieldAWhile(random);  // The request may be over by now.
+      if (state.BeginCancel(generation)) {
+        abort();
+      } else if (state.Generation() != generation) {
+        stale.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }};
+
+  unsigned int cancelled = 0;
+  for (unsigned int i = 0; i < STATE_REQUESTS; ++i) {
+    // Recycle the data of the previous request before the new one is visible to the cancellers.
+    data.m_generation = (state.Generation() + 1) & 0xFFFFFF;
+    data.m_aborted = false;
+    std::uint32_t generation = state.Reset();
+    if (generation != data.m_generation) errors.fetch_add(1);
+    published.store(generation, std::memory_order_relaxed);
+
+    // Every step gives the cancellers a chance to run, as waiting for its I/O operation would.
+    const RequestState::State steps[] = {RequestState::Idle, RequestState::Connecting, RequestState::Writing,
+                                         RequestState::Reading};
+    for (std::size_t step = 0; step + 1 < 4; ++step) {
+      std::this_thread::yield();
+      if (!state.Advance(steps[step], steps[step + 1])) break;
+    }
+    std::this_thread::yield();
+
+    bool was_cancelled = state.Finish();
+    if (was_cancelled != data.m_aborted) errors.fetch_add(1);
+    if (was_cancelled) ++cancelled;
+  }
+
+  stop.store(true);
+  user.join();
+  deadline.join();
+
+  console->info("request state: {} requests, {} cancelled, {} cancellations of a stale generation refused.",
+                STATE_REQUESTS, cancelled, stale.load());
+  return errors.load();
+}
+
+// Returns the number of failed checks.
+unsigned int StressClient(const char* mode, ClientConfig config, unsigned short port) {
+  auto console = logging::get();
+
+  std::vector<std::atomic<unsigned int>> completions(CLIENT_REQUESTS + 1);
+  for (auto& completion : completions) completion.store(0);
+  std::atomic<unsigned int> completed{0};
+  std::atomic<unsigned int> cancelled{0};
+  std::atomic<unsigned int> errors{0};
+
+  AsyncTCPClient client{4, config};
+  std::uint32_t random = 3;
+
+  for (unsigned int id = 1; id <= CLIENT_REQUESTS; ++id) {
+    auto on_complete = [&completions, &completed, &cancelled, &errors](unsigned int request_id, FrameView,
+                                                                      const asio::error_code& ec) {
+      if (ec == asio::error::operation_aborted) {
+        cancelled.fetch_add(1);
+      } else if (ec) {
+        errors.fetch_add(1);
+      }
+      if (completions[request_id].fetch_add(1) != 0) errors.fetch_add(1);
+      completed.fetch_add(1);
+    };
+    client.emulateLongComputationOp(0, "127.0.0.1", port, on_complete, id);
+
+    // Cancel the request at some point of its life, while the I/O threads are working on it.
+    random = YieldAWhile(random);
+    client.cancelRequest(id);
+  }
+
+  while (completed.load() != CLIENT_REQUESTS) std::this_thread::yield();
+  client.close();
+
+  console->info("{}: {} requests, {} cancelled, {} failed or completed more than once.", mode,
+                CLIENT_REQUESTS, cancelled.load(), errors.load());
+  return errors.load();
+}
+
+// Returns the number of failed checks.
+unsigned int StressTimerWheel() {
+  auto console = logging::get();
+
+  asio::io_service ios;
+  TimerWheel wheel{ios, std::chrono::milliseconds(1)};
+
+  // Every timer re-arms itself from its callback until it has expired WHEEL_EXPIRIES times. Some callbacks
+  // take longer than a tick, as a thread preempted while calling them would.
+  std::vector<std::unique_ptr<TimerWheel::Timer>> timers;
+  std::vector<std::atomic<unsigned int>> expiries(WHEEL_TIMERS);
+  for (unsigned int i = 0; i < WHEEL_TIMERS; ++i) {
+    expiries[i].store(0);
+    timers.emplace_back(new TimerWheel::Timer{[&wheel, &timers, &expiries, i]() {
+      unsigned int count = expiries[i].fetch_add(1) + 1;
+      if ((count + i) % 8 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(3));
+      if (count < WHEEL_EXPIRIES) {
+        wheel.Arm(*timers[i], TimerWheel::Clock::now() + std::chrono::milliseconds(1 + i % 3));
+      }
+    }});
+  }
+  for (unsigned int i = 0; i < WHEEL_TIMERS; ++i) {
+    wheel.Arm(*timers[i], TimerWheel::Clock::now() + std::chrono::milliseconds(1));
+  }
+
+  // The threads return once the last timer has expired and the wheel has stopped ticking.
+  std::vector<std::thread> threads;
+  for (unsigned int i = 0; i < WHEEL_THREADS; ++i) threads.emplace_back([&ios]() { ios.run(); });
+  for (auto& thread : threads) thread.join();
+
+  unsigned int errors = 0;
+  for (auto& count : expiries) errors += count.load() != WHEEL_EXPIRIES ? 1 : 0;
+
+  console->info("timer wheel: {} timers expired {} times each on {} threads, {} miscounted.", WHEEL_TIMERS,
+                WHEEL_EXPIRIES, WHEEL_THREADS, errors);
+  return errors;
+}
+
+int main() {
+  auto console = logging::setup();
+  LoopbackServer server{nullptr, std::chrono::microseconds(50)};
+
+  unsigned int errors = StressRequestState();
+
+  ClientConfig text;
+  ClientConfig binary;
+  binary.protocol = WireProtocol::Binary;
+  ClientConfig multiplexed;
+  multiplexed.multiplexed_connections = 2;
+
+  errors += StressClient("text", text, server.Port());
+  errors += StressClient("binary", binary, server.Port());
+  errors += StressClient("multiplexed", multiplexed, server.Port());
+
+  server.Stop();
+
+  errors += StressTimerWheel();
+
+  if (errors != 0) console->error("FAIL: {} check(s) failed.", errors);
+  return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+#define RECIPE_NO_MAIN
+#include "../ch04/03_Async_parallel_tcp_server.cpp"
+#include "../common/frame_reader.h"
+#include <algorithm>
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Compares the asynchronous server of ch04 serving its connections from one io_service shared by all its
+// threads, where the handlers of a connection may run on any thread and go through its strand, with one
+// io_service per thread, where a connection is bound to one thread and has no strand. Clients on loopback
+// keep a request in flight on each of their connections, the emulated processing of the requests is turned
+// off. Reports the requests served per second and, where the kernel allows it, the cache misses of the whole
+// process (server and clients) per request.
+
+const unsigned int CONNECTIONS = 64;
+const std::chrono::seconds DURATION{3};  // Per mode.
+
+// Counts the hardware cache misses of the calling thread and of the threads it starts from now on. The
+// misses of a thread are added up once it has exited.
+class CacheMissCounter {
+public:
+  CacheMissCounter() : m_fd{-1} {
+#ifdef __linux__
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    m_fd = static_cast<int>(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+  }
+  ~CacheMissCounter() {
+#ifdef __linux__
+    if (m_fd >= 0) ::close(m_fd);
+#endif
+  }
+  CacheMissCounter(const CacheMissCounter& src) = delete;
+  CacheMissCounter& operator=(const CacheMissCounter& rhs) = delete;
+
+  bool Available() const { return m_fd >= 0; }
+
+  std::uint64_t Read() const {
+    std::uint64_t count = 0;
+#ifdef __linux__
+    if (m_fd < 0 || ::read(m_fd, &count, sizeof(count)) != sizeof(count)) return 0;
+#endif
+    return count;
+  }
+
+private:
+  int m_fd;
+};
+
+// A client connection sending a request, waiting for its response and sending the next one until stopped.
+class ClientConnection {
+public:
+  ClientConnection(asio::io_service& ios, const std::atomic<bool>& stopped, std::uint64_t& responses)
+      : m_sock{ios}, m_stopped(stopped), m_responses(responses) {}
+
+  void Start(const asio::ip::tcp::endpoint& ep) {
+    m_sock.connect(ep);
+    m_sock.set_option(asio::ip::tcp::no_delay{true});
+    SendRequest();
+  }
+
+private:
+  void SendRequest() {
+    asio::async_write(m_sock, asio::buffer("EMULATE_LONG_COMP_OP 0\n", 23),
+                      [this](const asio::error_code& ec, std::size_t) {
+                        if (ec) return;
+                        AsyncReadFrame(m_sock, m_reader, [this](const asio::error_code& read_ec, FrameView) {
+                          if (read_ec) return;
+                          ++m_responses;
+                          if (!m_stopped.load(std::memory_order_relaxed)) SendRequest();
+                        });
+                      });
+  }
+
+private:
+  asio::ip::tcp::socket m_sock;
+  FrameReader m_reader;
+  const std::atomic<bool>& m_stopped;
+  std::uint64_t& m_responses;
+};
+
+// Returns a port no one is listening on.
+unsigned short FreePort() {
+  asio::io_service ios;
+  asio::ip::tcp::acceptor acceptor{ios, asio::ip::tcp::endpoint{asio::ip::address_v4::loopback(), 0}};
+  return acceptor.local_endpoint().port();
+}
+
+void Measure(const char* name, ServerMode mode, unsigned int num_threads) {
+  auto console = logging::get();
+
+  ServiceConfig config;
+  config.max_requests_per_connection = 0;
+  config.emulate_processing = false;
+
+  // Opened before any thread is started, so that all of them are counted.
+  CacheMissCounter cache_misses;
+
+  unsigned short port = FreePort();
+  Server srv{mode, IoServicePool::Dispatch::RoundRobin, config};
+  srv.Start(port, num_threads);
+
+  // The clients run on this thread.
+  asio::io_service ios;
+  std::atomic<bool> stopped{false};
+  std::uint64_t responses = 0;
+  std::vector<std::unique_ptr<ClientConnection>> connections;
+  for (unsigned int i = 0; i < CONNECTIONS; ++i) {
+    connections.emplace_back(new ClientConnection{ios, stopped, responses});
+    connections.back()->Start(asio::ip::tcp::endpoint{asio::ip::address_v4::loopback(), port});
+  }
+
+  // Stop sending after a while, the run ends once every connection has its last response.
+  asio::steady_timer timer{ios, DURATION};
+  timer.async_wait([&stopped](const asio::error_code&) { stopped.store(true); });
+
+  auto started = std::chrono::steady_clock::now();
+  ios.run();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+  connections.clear();
+  srv.Stop();
+
+  double rate = responses / elapsed.count();
+  if (cache_misses.Available()) {
+    console->info("{}: {:.0f} requests/s, {:.0f} cache misses per request.", name, rate,
+                  static_cast<double>(cache_misses.Read()) / std::max<std::uint64_t>(responses, 1));
+  } else {
+    console->info("{}: {:.0f} requests/s (cache misses not available, perf events are not permitted).", name,
+                  rate);
+  }
+}
+
+int main() {
+  auto console = logging::setup();
+
+  // The shared io_service needs several threads to have strands at all.
+  unsigned int num_threads = std::max(std::thread::hardware_concurrency(), 2u);
+  console->info("{} threads, {} client connections.", num_threads, CONNECTIONS);
+
+  Measure("shared io_service with strands", ServerMode::SharedIoService, num_threads);
+  Measure("io_service per thread, no strand", ServerMode::IoServicePerCore, num_threads);
+  return 0;
+}
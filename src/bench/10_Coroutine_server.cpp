@@ -0,0 +1,234 @@
+#define RECIPE_NO_MAIN
+#ifdef COROUTINE_SERVER
+#include "../ch04/05_Coroutine_tcp_server.cpp"
+#else
+#include "../ch04/03_Async_parallel_tcp_server.cpp"
+#endif
+#include "../common/frame_reader.h"
+#include "allocation_counter.h"
+#include <algorithm>
+#include <asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Measures what serving a connection costs the asynchronous server of ch04, built once with its completion
+// handlers (03_Async_parallel_tcp_server.cpp, `make bench`) and once with its coroutines
+// (05_Coroutine_tcp_server.cpp, -DCOROUTINE_SERVER, `make bench-coroutines`). Both serve their connections
+// from one io_service shared by their threads, through strands, with the emulated processing turned off. The
+// clients run in a child process, so that only the server is measured:
+// - the heap memory held by an idle connection, after it has served one request;
+// - the CPU time and the heap allocations of the server per request, under loopback connections sending
+//   their requests one at a time and in pipelined bursts.
+// Exits with a non-zero status if a response is missing or wrong.
+
+const unsigned int IDLE_CONNECTIONS = 1000;
+const unsigned int LOAD_CONNECTIONS = 64;
+const unsigned int WARMUP_ROUNDS = 100;     // Per connection, not measured.
+const unsigned int MEASURED_ROUNDS = 1000;  // Per connection.
+
+#ifdef COROUTINE_SERVER
+const char* SERVER_NAME = "coroutine server";
+
+std::unique_ptr<Server> MakeServer(const ServiceConfig& config) {
+  return std::unique_ptr<Server>{new Server{config}};
+}
+#else
+const char* SERVER_NAME = "callback server";
+
+std::unique_ptr<Server> MakeServer(const ServiceConfig& config) {
+  return std::unique_ptr<Server>{
+      new Server{ServerMode::SharedIoService, IoServicePool::Dispatch::RoundRobin, config}};
+}
+#endif
+
+// A client connection sending bursts of `depth` requests, each burst once the responses to the previous one
+// have all been received.
+class ClientConnection {
+public:
+  ClientConnection(asio::io_service& ios, unsigned int& errors) : m_sock{ios}, m_errors(errors) {}
+
+  void Connect(const asio::ip::tcp::endpoint& ep) {
+    m_sock.connect(ep);
+    m_sock.set_option(asio::ip::tcp::no_delay{true});
+  }
+
+  // Sends `rounds` bursts, completed once the io_service has run out of work.
+  void Start(unsigned int rounds, unsigned int depth) {
+    m_rounds = rounds;
+    m_depth = depth;
+    m_burst.clear();
+    for (unsigned int i = 0; i < depth; ++i) m_burst += "EMULATE_LONG_COMP_OP 0\n";
+    SendBurst();
+  }
+
+private:
+  void SendBurst() {
+    if (m_rounds == 0) return;
+    --m_rounds;
+    m_pending = m_depth;
+
+    asio::async_write(m_sock, asio::buffer(m_burst), [this](const asio::error_code& ec, std::size_t) {
+      if (ec) {
+        ++m_errors;
+        return;
+      }
+      ReadResponse();
+    });
+  }
+
+  void ReadResponse() {
+    AsyncReadFrame(m_sock, m_reader, [this](const asio::error_code& ec, FrameView response) {
+      if (ec || std::string(response.data, response.size) != "Response") {
+        ++m_errors;
+        return;
+      }
+      if (--m_pending != 0) {
+        ReadResponse();
+      } else {
+        SendBurst();
+      }
+    });
+  }
+
+private:
+  asio::ip::tcp::socket m_sock;
+  FrameReader m_reader;
+  std::string m_burst;
+  unsigned int m_rounds = 0;
+  unsigned int m_depth = 0;
+  unsigned int m_pending = 0;  // Responses of the current burst not received yet.
+  unsigned int& m_errors;
+};
+
+// Both processes tell each other where they are by writing single bytes into pipes.
+void Signal(int fd) {
+  char byte = 0;
+  if (::write(fd, &byte, 1) != 1) std::exit(1);
+}
+
+void Await(int fd) {
+  char byte;
+  if (::read(fd, &byte, 1) != 1) std::exit(1);
+}
+
+// Connects `count` clients, each one having one request answered.
+void ConnectClients(asio::io_service& ios, unsigned short port, unsigned int count, unsigned int& errors,
+                    std::vector<std::unique_ptr<ClientConnection>>& clients) {
+  for (unsigned int i = 0; i < count; ++i) {
+    clients.emplace_back(new ClientConnection{ios, errors});
+    clients.back()->Connect(asio::ip::tcp::endpoint{asio::ip::address_v4::loopback(), port});
+    clients.back()->Start(1, 1);
+  }
+  ios.run();
+  ios.restart();
+}
+
+// The child process. Every step is announced to the server, which measures it, before going on.
+int RunClients(unsigned short port, int to_server, int from_server) {
+  asio::io_service ios;
+  unsigned int errors = 0;
+
+  // Idle connections.
+  Await(from_server);
+  std::vector<std::unique_ptr<ClientConnection>> clients;
+  ConnectClients(ios, port, IDLE_CONNECTIONS, errors, clients);
+  Signal(to_server);
+  Await(from_server);
+  clients.clear();
+
+  // Load, the requests of a connection one at a time then in pipelined bursts.
+  for (unsigned int depth : {1, 8}) {
+    ConnectClients(ios, port, LOAD_CONNECTIONS, errors, clients);
+    for (auto& client : clients) client->Start(WARMUP_ROUNDS, depth);
+    ios.run();
+    ios.restart();
+
+    Signal(to_server);
+    Await(from_server);
+    for (auto& client : clients) client->Start(MEASURED_ROUNDS / depth, depth);
+    ios.run();
+    ios.restart();
+    Signal(to_server);
+    Await(from_server);
+    clients.clear();
+  }
+
+  return errors == 0 ? 0 : 1;
+}
+
+// Returns a port no one is listening on.
+unsigned short FreePort() {
+  asio::io_service ios;
+  asio::ip::tcp::acceptor acceptor{ios, asio::ip::tcp::endpoint{asio::ip::address_v4::loopback(), 0}};
+  return acceptor.local_endpoint().port();
+}
+
+// The connections the clients closed are cleaned up asynchronously by the server.
+void Settle() { std::this_thread::sleep_for(std::chrono::milliseconds(200)); }
+
+int main() {
+  unsigned short port = FreePort();
+
+  int to_server[2];
+  int from_server[2];
+  if (::pipe(to_server) != 0 || ::pipe(from_server) != 0) return 1;
+
+  // Forked before the server starts any thread.
+  pid_t child = ::fork();
+  if (child < 0) return 1;
+  if (child == 0) std::_Exit(RunClients(port, to_server[1], from_server[0]));
+
+  auto console = logging::setup();
+  int from_clients = to_server[0];
+  int to_clients = from_server[1];
+
+  ServiceConfig config;
+  config.max_requests_per_connection = 0;
+  config.emulate_processing = false;
+
+  unsigned int num_threads = std::max(std::thread::hardware_concurrency(), 2u);
+  std::unique_ptr<Server> srv = MakeServer(config);
+  srv->Start(port, num_threads);
+  console->info("{}: {} threads.", SERVER_NAME, num_threads);
+
+  Settle();
+  std::int64_t live_bytes = g_live_bytes.load();
+  Signal(to_clients);
+  Await(from_clients);
+  Settle();
+  console->info("{} idle connections: {:.0f} bytes of heap each.", IDLE_CONNECTIONS,
+                static_cast<double>(g_live_bytes.load() - live_bytes) / IDLE_CONNECTIONS);
+  Signal(to_clients);
+
+  for (unsigned int depth : {1, 8}) {
+    Await(from_clients);
+    std::clock_t cpu = std::clock();
+    std::uint64_t allocations = g_allocations.load();
+    Signal(to_clients);
+
+    Await(from_clients);
+    double requests = static_cast<double>(LOAD_CONNECTIONS) * (MEASURED_ROUNDS / depth) * depth;
+    double cpu_us = 1e6 * static_cast<double>(std::clock() - cpu) / CLOCKS_PER_SEC;
+    double allocations_per_request = (g_allocations.load() - allocations) / requests;
+    console->info("{} connections, {} request(s) in flight each: {:.1f} us of CPU, {:.2f} allocations per "
+                  "request.",
+                  LOAD_CONNECTIONS, depth, cpu_us / requests, allocations_per_request);
+    Signal(to_clients);
+  }
+
+  int status = 0;
+  ::waitpid(child, &status, 0);
+  srv->Stop();
+
+  bool failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  if (failed) console->error("FAIL: responses missing or wrong.");
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,41 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Replaces the global operator new of the program that includes it (once) to count the heap
+// allocations. The threads that set `t_uncounted` (e.g. those of a loopback server) are not counted.
+// With glibc, `g_live_bytes` also tracks the heap memory in use through operator new, by all the
+// threads (as malloc_usable_size() reports it, so allocator rounding included).
+
+std::atomic<std::uint64_t> g_allocations{0};
+std::atomic<std::int64_t> g_live_bytes{0};
+thread_local bool t_uncounted = false;
+
+void* operator new(std::size_t size) {
+  if (!t_uncounted) g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size == 0 ? 1 : size)) {
+#ifdef __GLIBC__
+    g_live_bytes.fetch_add(static_cast<std::int64_t>(malloc_usable_size(p)), std::memory_order_relaxed);
+#endif
+    return p;
+  }
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept {
+#ifdef __GLIBC__
+  if (p) g_live_bytes.fetch_sub(static_cast<std::int64_t>(malloc_usable_size(p)), std::memory_order_relaxed);
+#endif
+  std::free(p);
+}
+void operator delete(void* p, std::size_t /* size */) noexcept { operator delete(p); }
+
+#endif /* ALLOCATION_COUNTER_H */
@@ -0,0 +1,169 @@
+#ifndef LOOPBACK_SERVER_H
+#define LOOPBACK_SERVER_H
+
+#include "../common/binary_frame.h"
+#include "../common/frame_reader.h"
+#include "../common/message_builder.h"
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Server of the sample protocol for the benchmarks: it listens on an ephemeral loopback port and answers
+// every request at once, without emulating any processing, so the cost measured is the client's. Any number
+// of requests may be sent on a connection, as text lines or binary frames (pipelined or multiplexed), and
+// they are answered in order. Every connection is served by its own thread with blocking calls.
+class LoopbackServer {
+public:
+  // `on_thread_start` is called first thing by every thread of the server, e.g. to exclude it from a
+  // measurement. A non-zero `max_delay` delays every response by a random time below it, so that the client
+  // has requests in flight for a while.
+  explicit LoopbackServer(std::function<void()> on_thread_start = nullptr,
+                          std::chrono::microseconds max_delay = std::chrono::microseconds::zero())
+      : m_acceptor{m_ios, asio::ip::tcp::endpoint{asio::ip::address_v4::loopback(), 0}},
+        m_on_thread_start{std::move(on_thread_start)},
+        m_max_delay{max_delay},
+        m_stopped{false} {
+    m_acceptor.listen();
+    m_accept_thread = std::thread{[this]() { Accept(); }};
+  }
+  ~LoopbackServer() { Stop(); }
+  LoopbackServer(const LoopbackServer& src) = delete;
+  LoopbackServer& operator=(const LoopbackServer& rhs) = delete;
+
+  unsigned short Port() const { return m_acceptor.local_endpoint().port(); }
+
+  // Closes all the connections and waits for the threads of the server to exit.
+  void Stop() {
+    {
+      std::unique_lock<std::mutex> lock{m_guard};
+      if (m_stopped) return;
+      m_stopped = true;
+
+      asio::error_code ignored_ec;
+      for (auto& conn : m_connections) {
+        conn->m_sock.shutdown(asio::ip::tcp::socket::shutdown_both, ignored_ec);
+      }
+    }
+
+    // Wake the acceptor up with a connection of our own.
+    asio::ip::tcp::socket waker{m_ios};
+    asio::error_code ignored_ec;
+    waker.connect(asio::ip::tcp::endpoint{asio::ip::address_v4::loopback(), Port()}, ignored_ec);
+    m_accept_thread.join();
+
+    for (auto& conn : m_connections) conn->m_thread.join();
+  }
+
+private:
+  struct Connection {
+    explicit Connection(asio::io_service& ios) : m_sock{ios}, m_done{false} {}
+
+    asio::ip::tcp::socket m_sock;
+    std::thread m_thread;
+    std::atomic<bool> m_done;  // Set by the thread when it is about to exit.
+  };
+
+  void Accept() {
+    if (m_on_thread_start) m_on_thread_start();
+
+    for (;;) {
+      std::unique_ptr<Connection> conn{new Connection{m_ios}};
+      asio::error_code ec;
+      m_acceptor.accept(conn->m_sock, ec);
+
+      std::unique_lock<std::mutex> lock{m_guard};
+      if (m_stopped) return;
+      if (ec) continue;
+
+      asio::ip::tcp::no_delay no_delay{true};
+      conn->m_sock.set_option(no_delay, ec);
+
+      // Join the threads of the connections closed since, clients may open a great many connections.
+      for (auto it = m_connections.begin(); it != m_connections.end();) {
+        if (!(*it)->m_done.load()) {
+          ++it;
+          continue;
+        }
+        (*it)->m_thread.join();
+        it = m_connections.erase(it);
+      }
+
+      Connection* served = conn.get();
+      conn->m_thread = std::thread{[this, served]() {
+        Serve(served->m_sock);
+        served->m_done.store(true);
+      }};
+      m_connections.push_back(std::move(conn));
+    }
+  }
+
+  void Serve(asio::ip::tcp::socket& sock) {
+    if (m_on_thread_start) m_on_thread_start();
+
+    try {
+      if (DetectProtocol(sock) == WireProtocol::Binary) {
+        ServeBinary(sock);
+      } else {
+        ServeText(sock);
+      }
+    } catch (asio::system_error&) {
+      // The client is gone or the server is stopping.
+    }
+  }
+
+  void ServeText(asio::ip::tcp::socket& sock) const {
+    FrameReader reader;
+    std::uint32_t random = 1;
+    for (;;) {
+      ReadFrame(sock, reader);
+      random = Delay(random);
+      asio::write(sock, asio::buffer("Response\n", 9));
+    }
+  }
+
+  void ServeBinary(asio::ip::tcp::socket& sock) const {
+    PayloadPool payload_pool{PayloadBufferFactory(), 1};
+    BinaryFrameReader request{payload_pool};
+    unsigned char header[BINARY_FRAME_HEADER_SIZE];
+    MessageBuilder msg;
+    std::uint32_t random = 1;
+
+    for (;;) {
+      request.Read(sock);
+      random = Delay(random);
+
+      msg.Clear();
+      AppendBinaryFrame(msg, header, FrameType::Response, request.Header().request_id, "Response", 8);
+      asio::write(sock, msg.Buffers());
+      request.Release();
+    }
+  }
+
+  // Sleeps for a random time below the maximum delay, if any. Returns the next state of the generator.
+  std::uint32_t Delay(std::uint32_t random) const {
+    if (m_max_delay == std::chrono::microseconds::zero()) return random;
+
+    random = random * 1103515245 + 12345;
+    std::this_thread::sleep_for(std::chrono::microseconds((random >> 8) % m_max_delay.count()));
+    return random;
+  }
+
+private:
+  asio::io_service m_ios;
+  asio::ip::tcp::acceptor m_acceptor;
+  std::function<void()> m_on_thread_start;
+  std::chrono::microseconds m_max_delay;
+  std::thread m_accept_thread;
+
+  std::list<std::unique_ptr<Connection>> m_connections;
+  bool m_stopped;
+  std::mutex m_guard;  // Protects m_connections and m_stopped.
+};
+
+#endif /* LOOPBACK_SERVER_H */
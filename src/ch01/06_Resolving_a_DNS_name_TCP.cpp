@@ -1,4 +1,5 @@
 #include "../common/logging.h"
+#include "../common/resolver_cache.h"
 #include <asio.hpp>
 
 int main() {
@@ -12,32 +13,41 @@ int main() {
   // Step 2.
   asio::io_service ios;
 
-  // Step 3. Creating a query.
-  asio::ip::tcp::resolver::query resolver_query(host, port_num,
-                                                asio::ip::tcp::resolver::query::numeric_service);
-
-  // Step 4. Creating a resolver.
-  asio::ip::tcp::resolver resolver(ios);
+  // Step 3. Creating a resolver keeping the results of its lookups. A real application keeps a single one
+  // and resolves all its names through it.
+  ResolverCache resolver(ios);
 
   // Used to store information about error that happens during the resolution process.
   asio::error_code ec;
 
-  // Step 5.
-  asio::ip::tcp::resolver::iterator it = resolver.resolve(resolver_query, ec);
-
-  // Handling errors if any.
-  if (ec.value() != 0) {
-    // Failed to resolve the DNS name. Breaking execution.
-    console->error("Failed to resolve a DNS name. Error code = {}. Message = {}", ec.value(), ec.message());
-    return ec.value();
-  }
-
-  asio::ip::tcp::resolver::iterator it_end;
-  for (; it != it_end; ++it) {
-    // Here we can access the endpoint like this.
-    auto ep = it->endpoint();
-    console->debug("Endpoint: {}", ep);
-  }
-
-  return 0;
+  auto on_resolved = [&console, &ec](const asio::error_code& resolve_ec, ResolverCache::Endpoints endpoints) {
+    // Handling errors if any.
+    if (resolve_ec.value() != 0) {
+      // Failed to resolve the DNS name.
+      console->error("Failed to resolve a DNS name. Error code = {}. Message = {}", resolve_ec.value(),
+                     resolve_ec.message());
+      ec = resolve_ec;
+      return;
+    }
+
+    for (const auto& ep : *endpoints) {
+      // Here we can access the endpoint like this.
+      console->debug("Endpoint: {}", ep);
+    }
+  };
+
+  // Step 4. Resolving the name. The second request does not query the DNS, it waits for the lookup started by
+  // the first one.
+  resolver.AsyncResolve(host, port_num, on_resolved);
+  resolver.AsyncResolve(host, port_num, on_resolved);
+
+  // Step 5. Running the lookup.
+  ios.run();
+
+  // Step 6. The result is cached now, this request is answered without any lookup.
+  ios.reset();
+  resolver.AsyncResolve(host, port_num, on_resolved);
+  ios.run();
+
+  return ec.value();
 }
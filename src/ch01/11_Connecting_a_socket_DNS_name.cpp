@@ -1,5 +1,8 @@
+#include "../common/happy_eyeballs.h"
 #include "../common/logging.h"
+#include "../common/resolver_cache.h"
 #include <asio.hpp>
+#include <chrono>
 
 int main() {
   auto console = logging::setup();
@@ -12,34 +15,50 @@ int main() {
   // Used by 'resolver' and 'socket'.
   asio::io_service ios;
 
-  // Creating a resolver's query.
-  asio::ip::tcp::resolver::query resolver_query(host, port_num,
-                                                asio::ip::tcp::resolver::query::numeric_service);
+  // Creating a resolver keeping the results of its lookups, reconnecting to the same name does not query the
+  // DNS again.
+  ResolverCache resolver(ios);
 
-  // Creating a resolver.
-  asio::ip::tcp::resolver resolver(ios);
+  // Step 2. Creating a socket.
+  asio::ip::tcp::socket sock(ios);
 
-  try {
-    // Step 2. Resolving a DNS name.
-    auto it = resolver.resolve(resolver_query);
+  // Used to store information about error that happens while resolving or connecting.
+  asio::error_code ec;
 
-    // Step 3. Creating a socket.
-    asio::ip::tcp::socket sock(ios);
+  // Step 3. Resolving a DNS name.
+  resolver.AsyncResolve(host, port_num, [&](const asio::error_code& resolve_ec,
+                                            ResolverCache::Endpoints endpoints) {
+    if (resolve_ec.value() != 0) {
+      ec = resolve_ec;
+      return;
+    }
 
-    // Step 4. asio::connect() method iterates over each endpoint until successfully connects to one of them.
-    // It will throw an exception if it fails to connect to all the endpoints or if other error occurs.
-    asio::connect(sock, it);
+    // Step 4. Connecting to the first endpoint that answers. The candidates are raced: a new attempt starts
+    // every 250ms while the previous ones are pending (alternating IPv6 and IPv4), so a dead address does not
+    // hold the connection for a full connect timeout. The attempts that lose are cancelled. An error is
+    // reported if it fails to connect to all the endpoints.
+    HappyEyeballsConnect::Start(ios, sock, *endpoints,
+                                [&](const asio::error_code& connect_ec, const asio::ip::tcp::endpoint& ep,
+                                    std::chrono::steady_clock::duration latency) {
+                                  ec = connect_ec;
+                                  if (ec.value() != 0) return;
 
-    // At this point socket 'sock' is connected to the server application and can be used to send data to or
-    // receive data from it.
-    console->info("Socket is connected to the server!");
-  }
-  // Overloads of asio::ip::tcp::resolver::resolve and asio::connect() used here throw exceptions in case of
-  // error condition.
-  catch (asio::system_error& e) {
-    console->error("Error occurred! Error code = {}. Message: {}", e.code(), e.what());
-    return e.code().value();
+                                  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(latency);
+                                  console->info("Connected to {}:{} in {} ms", ep.address().to_string(),
+                                                ep.port(), ms.count());
+                                });
+  });
+
+  ios.run();
+
+  if (ec.value() != 0) {
+    console->error("Error occurred! Error code = {}. Message: {}", ec.value(), ec.message());
+    return ec.value();
   }
 
+  // At this point socket 'sock' is connected to the server application and can be used to send data to or
+  // receive data from it.
+  console->info("Socket is connected to the server!");
+
   return 0;
 }
@@ -1,4 +1,5 @@
 #include "../common/logging.h"
+#include "../common/message_builder.h"
 #include <asio.hpp>
 #include <iostream>
 
@@ -43,6 +44,19 @@ void writeToSocketEnhanced(asio::ip::tcp::socket& sock) {
   asio::write(sock, asio::buffer(buf));
 }
 
+void writeToSocketGather(asio::ip::tcp::socket& sock) {
+  // The message is made of parts living in different places: a header literal, a body owned by someone else
+  // and a trailer. Instead of concatenating them, the buffers referencing each part are collected and
+  // written with a single gather operation.
+  std::string body = "Hello";
+
+  MessageBuilder msg;
+  msg.Append("Length: ").AppendNumber(body.length()).Append("\n").Append(body).Append("\n");
+
+  // Write all the parts to the socket.
+  asio::write(sock, msg.Buffers());
+}
+
 int main() {
   auto console = logging::setup();
 
@@ -59,6 +73,7 @@ int main() {
 
     // writeToSocket(sock);
     // writeToSocketUsingSend(sock);
+    // writeToSocketGather(sock);
     writeToSocketEnhanced(sock);
   } catch (asio::system_error& e) {
     console->error("Error occurred! Error code = {}. Message: {}", e.code(), e.what());
@@ -1,18 +1,49 @@
+#include "../common/binary_frame.h"
+#include "../common/frame_reader.h"
 #include "../common/logging.h"
+#include "../common/message_builder.h"
 #include <asio.hpp>
+#include <chrono>
+#include <cstring>
 
 class SyncTCPClient {
 public:
-  SyncTCPClient(const std::string& raw_ip_address, unsigned short port_num)
-      : m_ep(asio::ip::address::from_string(raw_ip_address), port_num), m_sock(m_ios) {
+  SyncTCPClient(const std::string& raw_ip_address, unsigned short port_num,
+                WireProtocol protocol = WireProtocol::Text)
+      : m_ep(asio::ip::address::from_string(raw_ip_address), port_num),
+        m_sock(m_ios),
+        m_timer(m_ios),
+        m_protocol{protocol},
+        m_payload_buffers{PayloadBufferFactory(), 1},
+        m_binary_reader{m_payload_buffers},
+        m_next_request_id{0} {
     m_sock.open(m_ep.protocol());
   }
   ~SyncTCPClient() { close(); }
 
-  void connect() { m_sock.connect(m_ep); }
+  void connect() {
+    asio::error_code ec = asio::error::would_block;
+    m_sock.async_connect(m_ep, [&ec](const asio::error_code& connect_ec) { ec = connect_ec; });
+    runUntilComplete(ec, CONNECT_TIMEOUT);
+  }
 
   std::string emulateLongComputationOp(unsigned int duration_sec) {
-    std::string request = "EMULATE_LONG_COMP_OP " + std::to_string(duration_sec) + "\n";
+    // The request is sent in parts with a single gather write, no concatenated copy is built.
+    MessageBuilder request;
+    if (m_protocol == WireProtocol::Binary) {
+      // The header references m_request_header, it is encoded once the payload length is known.
+      request.Append(m_request_header, BINARY_FRAME_HEADER_SIZE);
+      request.Append("EMULATE_LONG_COMP_OP ").AppendNumber(duration_sec);
+
+      BinaryFrameHeader header;
+      header.type = FrameType::Request;
+      header.length = static_cast<std::uint32_t>(request.Size() - BINARY_FRAME_HEADER_SIZE);
+      header.request_id = ++m_next_request_id;
+      header.Encode(m_request_header);
+    } else {
+      request.Append("EMULATE_LONG_COMP_OP ").AppendNumber(duration_sec).Append("\n");
+    }
+
     sendRequest(request);
     return receiveResponse();
   }
@@ -27,33 +58,98 @@ private:
     }
   }
 
-  void sendRequest(const std::string& request) { asio::write(m_sock, asio::buffer(request)); }
+  // Every step is an asynchronous operation run to completion on the client's own io_service, because the
+  // blocking calls of asio cannot be bounded in time. If the step is not over by `timeout` the socket is
+  // closed, which aborts it, and asio::error::timed_out is thrown; the client cannot be used any more.
+  void runUntilComplete(asio::error_code& ec, std::chrono::steady_clock::duration timeout) {
+    bool timed_out = false;
+    m_timer.expires_from_now(timeout);
+    m_timer.async_wait([this, &timed_out](const asio::error_code& timer_ec) {
+      if (timer_ec == asio::error::operation_aborted) return;
+
+      timed_out = true;
+      asio::error_code ignored_ec;
+      m_sock.close(ignored_ec);
+    });
+
+    m_ios.reset();
+    while (ec == asio::error::would_block) m_ios.run_one();
+
+    // The timer handler references `timed_out`, it has to run before returning.
+    m_timer.cancel();
+    m_ios.run();
+
+    if (timed_out) throw asio::system_error(asio::error::timed_out);
+    if (ec) throw asio::system_error(ec);
+  }
 
-  std::string receiveResponse() {
-    asio::streambuf buf;
-    asio::read_until(m_sock, buf, '\n');
+  void sendRequest(const MessageBuilder& request) {
+    asio::error_code ec = asio::error::would_block;
+    asio::async_write(m_sock, request.Buffers(),
+                      [&ec](const asio::error_code& write_ec, std::size_t /* bytes */) { ec = write_ec; });
+    runUntilComplete(ec, WRITE_TIMEOUT);
+  }
 
-    std::istream input(&buf);
-    std::string response;
-    std::getline(input, response);
+  std::string receiveResponse() {
+    asio::error_code ec = asio::error::would_block;
+
+    if (m_protocol == WireProtocol::Binary) {
+      m_binary_reader.AsyncRead(m_sock, [&ec](const asio::error_code& read_ec) { ec = read_ec; });
+      runUntilComplete(ec, READ_TIMEOUT);
+      if (m_binary_reader.Header().request_id != m_next_request_id) {
+        throw asio::system_error(asio::error::invalid_argument);
+      }
+
+      std::string response = m_binary_reader.Payload().ToString();
+      m_binary_reader.Release();
+      return response;
+    }
 
-    return response;
+    // The response is framed directly in the receive buffer, no stream or intermediate copy is involved.
+    FrameView response;
+    AsyncReadFrame(m_sock, m_reader, [&ec, &response](const asio::error_code& read_ec, FrameView frame) {
+      ec = read_ec;
+      response = frame;
+    });
+    runUntilComplete(ec, READ_TIMEOUT);
+    return response.ToString();
   }
 
 private:
+  // Maximum time the steps of a request may take, the same defaults as the asynchronous clients.
+  static constexpr std::chrono::seconds CONNECT_TIMEOUT{5};
+  static constexpr std::chrono::seconds WRITE_TIMEOUT{5};
+  static constexpr std::chrono::seconds READ_TIMEOUT{30};
+
   asio::io_service m_ios;
   asio::ip::tcp::endpoint m_ep;
   asio::ip::tcp::socket m_sock;
+  asio::steady_timer m_timer;  // Deadline of the current step.
+  FrameReader m_reader;  // Receive buffer the text responses are framed in.
+
+  WireProtocol m_protocol;
+  PayloadPool m_payload_buffers;      // Buffers the binary responses are received in.
+  BinaryFrameReader m_binary_reader;  // Reads the binary responses.
+  std::uint64_t m_next_request_id;    // Id of the last binary request sent.
+  unsigned char m_request_header[BINARY_FRAME_HEADER_SIZE];
 };
 
-int main() {
+constexpr std::chrono::seconds SyncTCPClient::CONNECT_TIMEOUT;
+constexpr std::chrono::seconds SyncTCPClient::WRITE_TIMEOUT;
+constexpr std::chrono::seconds SyncTCPClient::READ_TIMEOUT;
+
+// Usage: 01_SyncTCPClient [text|binary]
+int main(int argc, char* argv[]) {
   auto console = logging::setup();
 
+  WireProtocol protocol = WireProtocol::Text;
+  if (argc > 1 && std::strcmp(argv[1], "binary") == 0) protocol = WireProtocol::Binary;
+
   const std::string raw_ip_address = "127.0.0.1";
   const unsigned short port_num = 3333;
 
   try {
-    SyncTCPClient client{raw_ip_address, port_num};
+    SyncTCPClient client{raw_ip_address, port_num, protocol};
 
     // Sync connect.
     client.connect();
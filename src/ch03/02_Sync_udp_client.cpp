@@ -1,19 +1,83 @@
+#include "../common/arena.h"
+#include "../common/datagram_batch.h"
 #include "../common/logging.h"
+#include <algorithm>
 #include <asio.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <poll.h>
+#include <vector>
 
 class SyncUDPClient {
 public:
-  SyncUDPClient() : m_sock(m_ios) { m_sock.open(asio::ip::udp::v4()); }
+  SyncUDPClient()
+      : m_sock(m_ios), m_requests{BATCH_SIZE, MAX_DATAGRAM_SIZE}, m_responses{BATCH_SIZE, MAX_DATAGRAM_SIZE} {
+    m_sock.open(asio::ip::udp::v4());
+  }
   ~SyncUDPClient() { close(); }
 
   std::string emulateLongComputationOp(unsigned int duration_sec, const std::string& raw_ip_address,
                                        unsigned short port_num) {
-    std::string request = "EMULATE_LONG_COMP_OP " + std::to_string(duration_sec) + "\n";
+    // The request is built in an arena of this thread, which goes back to the thread's cache with it.
+    PooledArena arena = ArenaCache::Acquire();
+    ArenaString request{ArenaAllocator<char>{*arena}};
+    char duration[16];
+    int len = std::snprintf(duration, sizeof(duration), "%u", duration_sec);
+    request.append("EMULATE_LONG_COMP_OP ").append(duration, static_cast<std::size_t>(len)).append("\n");
+
+    asio::ip::udp::endpoint ep{asio::ip::address::from_string(raw_ip_address), port_num};
+
+    sendRequest(ep, asio::buffer(request.data(), request.size()));
+    return receiveResponse(ep, std::chrono::steady_clock::now() + std::chrono::seconds(duration_sec) +
+                                   RESPONSE_TIMEOUT);
+  }
 
+  // Sends one request per duration and collects the responses. Requests and responses move in batches of up
+  // to BATCH_SIZE datagrams per system call. Responses are returned in arrival order; datagrams are lost
+  // silently, so the responses of a batch are awaited until RESPONSE_TIMEOUT after its longest operation and
+  // fewer responses than requests are returned if some did not arrive by then.
+  std::vector<std::string> emulateLongComputationOps(const std::vector<unsigned int>& durations_sec,
+                                                     const std::string& raw_ip_address,
+                                                     unsigned short port_num) {
     asio::ip::udp::endpoint ep{asio::ip::address::from_string(raw_ip_address), port_num};
 
-    sendRequest(ep, request);
-    return receiveResponse(ep);
+    std::vector<std::string> responses;
+    responses.reserve(durations_sec.size());
+
+    std::size_t next = 0;
+    while (next < durations_sec.size()) {
+      // Format the requests straight into the slots of the batch.
+      m_requests.Clear();
+      for (; next < durations_sec.size() && !m_requests.Full(); ++next) {
+        char* slot = m_requests.Add(ep);
+        int len = std::snprintf(slot, m_requests.MaxDatagramSize(), "EMULATE_LONG_COMP_OP %u\n",
+                                durations_sec[next]);
+        m_requests.Resize(m_requests.Size() - 1, static_cast<std::size_t>(len));
+      }
+
+      SendDatagrams(m_sock, m_requests);
+
+      auto longest = *std::max_element(durations_sec.begin() + (next - m_requests.Size()),
+                                       durations_sec.begin() + next);
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(longest) + RESPONSE_TIMEOUT;
+
+      std::size_t pending = m_requests.Size();
+      while (pending > 0 && waitForResponse(deadline)) {
+        ReceiveDatagrams(m_sock, m_responses);
+        for (std::size_t i = 0; i < m_responses.Size() && pending > 0; ++i) {
+          // Stray datagrams from other peers are not responses to the batch.
+          if (m_responses.Endpoint(i) != ep) continue;
+
+          responses.emplace_back(m_responses.Data(i), m_responses.Size(i));
+          --pending;
+        }
+      }
+
+      if (pending > 0) logging::get()->warn("{} responses did not arrive in time.", pending);
+    }
+
+    return responses;
   }
 
 private:
@@ -26,22 +90,59 @@ private:
     }
   }
 
-  void sendRequest(const asio::ip::udp::endpoint& ep, const std::string& request) {
-    m_sock.send_to(asio::buffer(request), ep);
+  void sendRequest(const asio::ip::udp::endpoint& ep, asio::const_buffers_1 request) {
+    m_sock.send_to(request, ep);
   }
 
-  std::string receiveResponse(asio::ip::udp::endpoint& ep) {
+  // Receives the response from `ep`, ignoring datagrams from other peers. Throws asio::error::timed_out if it
+  // has not arrived by the deadline.
+  std::string receiveResponse(const asio::ip::udp::endpoint& ep,
+                              std::chrono::steady_clock::time_point deadline) {
     char response[6];
-    std::size_t bytes_received = m_sock.receive_from(asio::buffer(response), ep);
+    asio::ip::udp::endpoint sender;
+
+    while (waitForResponse(deadline)) {
+      std::size_t bytes_received = m_sock.receive_from(asio::buffer(response), sender);
+      if (sender == ep) return std::string(response, bytes_received);
+    }
+
+    throw asio::system_error(asio::error::timed_out);
+  }
 
-    return std::string(response, bytes_received);
+  // Waits until a datagram can be received or the deadline passes, in which case it returns false. The wait
+  // is done with poll() because the blocking receive calls would retry on their own after an SO_RCVTIMEO
+  // timeout.
+  bool waitForResponse(std::chrono::steady_clock::time_point deadline) {
+    for (;;) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= deadline) return false;
+
+      auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count() + 1;
+      pollfd fd{m_sock.native_handle(), POLLIN, 0};
+      int n = ::poll(&fd, 1, static_cast<int>(timeout));
+      if (n > 0) return true;
+      if (n < 0 && errno != EINTR) {
+        throw asio::system_error(asio::error_code(errno, asio::error::get_system_category()));
+      }
+    }
   }
 
 private:
+  // Maximum number of datagrams sent or received per system call.
+  static const std::size_t BATCH_SIZE = 64;
+  static const std::size_t MAX_DATAGRAM_SIZE = 64;
+
+  // How long a response may take beyond the duration of the emulated operation before it is deemed lost.
+  static constexpr std::chrono::seconds RESPONSE_TIMEOUT{2};
+
   asio::io_service m_ios;
   asio::ip::udp::socket m_sock;
+  DatagramBatch m_requests;   // Reused by all the batched calls.
+  DatagramBatch m_responses;
 };
 
+constexpr std::chrono::seconds SyncUDPClient::RESPONSE_TIMEOUT;
+
 int main() {
   auto console = logging::setup();
 
@@ -58,6 +159,11 @@ int main() {
     std::string response = client.emulateLongComputationOp(10, server1_raw_ip_address, server1_port_num);
     console->info("Response from the server #1 received: {}", response);
 
+    console->info("Sending a batch of requests to the server #1 ...");
+    std::vector<std::string> responses =
+        client.emulateLongComputationOps({1, 2, 3, 4}, server1_raw_ip_address, server1_port_num);
+    console->info("{} responses from the server #1 received.", responses.size());
+
     // console->info("Sending request to the server #2 ...");
     // response = client.emulateLongComputationOp(10, server2_raw_ip_address, server2_port_num);
     // console->info("Response from the server #2 received: {}", response);
@@ -3,49 +3,131 @@
 // to run the event loop and call the asynchronous operation's callback routines. Such configuration allows us
 // to make our application's user interface responsive.
 
+#include "../common/binary_frame.h"
+#include "../common/frame_reader.h"
+#include "../common/handler_allocator.h"
+#include "../common/inplace_function.h"
 #include "../common/logging.h"
+#include "../common/message_builder.h"
+#include "../common/object_pool.h"
+#include "../common/recycling_allocator.h"
+#include "../common/request_state.h"
+#include "../common/timer_wheel.h"
+#include <algorithm>
 #include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
 
-// Function pointer type that points to the callback function which is called when a request is complete.
-typedef void (*Callback)(unsigned int request_id, const std::string& response, const asio::error_code& ec);
+// Callback called when a request is complete. It may carry its own context (e.g. a lambda capturing a few
+// pointers), which is stored in the session without any allocation. The response points into the buffer it
+// was received in and is only valid during the call; it is empty if the request failed.
+typedef InplaceFunction<void(unsigned int request_id, FrameView response, const asio::error_code& ec)>
+    Callback;
+
+// Maximum time the steps of a request may take. A request that misses a deadline is cancelled and completes
+// with asio::error::timed_out. Zero means no limit.
+struct RequestDeadlines {
+  std::chrono::steady_clock::duration connect = std::chrono::seconds(5);
+  std::chrono::steady_clock::duration write = std::chrono::seconds(5);
+  std::chrono::steady_clock::duration read = std::chrono::seconds(30);
+  std::chrono::steady_clock::duration total = std::chrono::seconds(60);  // Whole request, from its start.
+};
 
-// Structure represents a context of a single request.
-struct Session {
-  Session(asio::io_service& ios, const std::string& raw_ip_address, unsigned short port_num,
-          const std::string& request, unsigned int id, Callback callback)
+// Structure represents a context of a single request. Sessions are recycled by the client: a session object
+// and its buffers are reused by the following requests, so issuing a request does not allocate.
+struct Session : public std::enable_shared_from_this<Session> {
+  Session(asio::io_service& ios, PayloadPool& payload_pool, std::function<void(Session&)> on_deadline)
       : m_sock{ios},
-        m_ep{asio::ip::address::from_string(raw_ip_address), port_num},
-        m_request{request},
-        m_id{id},
-        m_callback{callback},
-        m_was_cancelled{false} {}
+        m_protocol{WireProtocol::Text},
+        m_binary_reader{payload_pool},
+        m_id{0},
+        m_deadline{std::chrono::steady_clock::time_point::max()},
+        m_deadline_timer{[this, on_deadline]() { on_deadline(*this); }},
+        m_timed_out{false} {}
+
+  // Prepares a fresh or recycled session for a new request.
+  void reset(unsigned int duration_sec, const std::string& raw_ip_address, unsigned short port_num,
+             unsigned int id, Callback&& callback, WireProtocol protocol) {
+    m_ep = asio::ip::tcp::endpoint{asio::ip::address::from_string(raw_ip_address), port_num};
+    m_protocol = protocol;
+
+    // Building the request in place reuses the capacity left by the previous request.
+    m_request.assign("EMULATE_LONG_CALC_OP ");
+    m_request += std::to_string(duration_sec);
+
+    // A binary request is the same command prefixed with a frame header instead of terminated by a newline.
+    m_request_msg.Clear();
+    if (m_protocol == WireProtocol::Binary) {
+      AppendBinaryFrame(m_request_msg, m_request_header, FrameType::Request, id, m_request.data(),
+                        m_request.size());
+    } else {
+      m_request += '\n';
+      m_request_msg.Append(m_request);
+    }
+
+    m_response_reader.Clear();
+    m_binary_reader.Release();
+    m_ec = asio::error_code{};
+    m_id = id;
+    m_callback = std::move(callback);
+    m_deadline.store(std::chrono::steady_clock::time_point::max(), std::memory_order_relaxed);
+    m_timed_out = false;
+    m_state.Reset();
+  }
 
   asio::ip::tcp::socket m_sock;  // Socket used for communication
   asio::ip::tcp::endpoint m_ep;  // Remote endpoint.
+  WireProtocol m_protocol;       // Protocol the request is sent with.
   std::string m_request;         // Request string;
+  unsigned char m_request_header[BINARY_FRAME_HEADER_SIZE];  // Frame header of a binary request.
+  MessageBuilder m_request_msg;                              // Request as written to the socket.
 
-  asio::streambuf m_response_buf;  // streambuf where the response will be stored.
-  std::string m_response;          // Response represented as a string.
+  FrameReader m_response_reader;      // Receive buffer a text response is framed in.
+  BinaryFrameReader m_binary_reader;  // Reads a binary response into a pooled buffer.
 
   // Contains the description of an error if one occurs during the request lifecycle.
   asio::error_code m_ec;
 
   unsigned int m_id;  // Unique ID assigned to the request.
 
-  // Pointer to the function to be called when the request completes.
+  // Function to be called when the request completes.
   Callback m_callback;
 
-  bool m_was_cancelled;
-  std::mutex m_cancel_guard;
+  std::chrono::steady_clock::time_point m_request_deadline;         // Deadline of the whole request.
+  std::atomic<std::chrono::steady_clock::time_point> m_deadline;  // Deadline of the current step.
+  TimerWheel::Timer m_deadline_timer;                               // Armed on the current step's deadline.
+  bool m_timed_out;  // Set by the canceller when the request is cancelled on a deadline.
+
+  // Step the request is at, and whether it has been cancelled.
+  RequestState m_state;
+
+  // Memory the asynchronous operations of the session are allocated from. A session never has more than
+  // one operation in flight.
+  HandlerMemory m_handler_memory;
 };
 
 class AsyncTCPClient {
 public:
-  AsyncTCPClient() {
+  explicit AsyncTCPClient(WireProtocol protocol = WireProtocol::Text,
+                          const RequestDeadlines& deadlines = RequestDeadlines{})
+      : m_protocol{protocol},
+        m_deadlines(deadlines),
+        m_timers{m_ios, TIMER_TICK},
+        m_payload_buffers{PayloadBufferFactory(), MAX_FREE_SESSIONS},
+        m_sessions{[this]() {
+                     return std::make_shared<Session>(m_ios, m_payload_buffers, [this](Session& session) {
+                       onDeadline(session.shared_from_this());
+                     });
+                   },
+                   MAX_FREE_SESSIONS},
+        m_active_sessions{std::less<unsigned int>{}, SessionMapAllocator{m_active_sessions_nodes}} {
     m_work.reset(new asio::io_service::work{m_ios});
     m_thread.reset(new std::thread{[this]() { m_ios.run(); }});
   }
@@ -57,10 +139,10 @@ public:
 
   void emulateLongComputationOp(unsigned int duration_sec, const std::string& raw_ip_address,
                                 unsigned short port_num, Callback callback, unsigned int request_id) {
-    // Preparing the request string.
-    std::string request = "EMULATE_LONG_CALC_OP " + std::to_string(duration_sec) + "\n";
-
-    auto session = std::make_shared<Session>(m_ios, raw_ip_address, port_num, request, request_id, callback);
+    // Take a recycled session and prepare the request in it.
+    auto session = m_sessions.Acquire();
+    session->reset(duration_sec, raw_ip_address, port_num, request_id, std::move(callback), m_protocol);
+    session->m_request_deadline = Deadline(m_deadlines.total);
     session->m_sock.open(session->m_ep.protocol());
 
     {  // Add new session to the list of active sessions so that we can access it if the user decides to
@@ -70,52 +152,49 @@ public:
       m_active_sessions[request_id] = session;
     }
 
-    session->m_sock.async_connect(session->m_ep, [this, session](const asio::error_code& connect_ec) {
+    // Every handler is wrapped so that the operation it completes is allocated from the session's memory.
+    auto on_connect = [this, session](const asio::error_code& connect_ec) {
       if (connect_ec.value() != 0) {
         session->m_ec = connect_ec;
         onRequestComplete(session);
         return;
       }
 
-      {
-        std::unique_lock<std::mutex> cancel_lock{session->m_cancel_guard};
-        if (session->m_was_cancelled) {
+      if (!session->m_state.Advance(RequestState::Connecting, RequestState::Writing)) {
+        // The request has been cancelled meanwhile.
+        onRequestComplete(session);
+        return;
+      }
+
+      auto on_write = [this, session](const asio::error_code& write_ec, std::size_t /* bytes_transferred */) {
+        if (write_ec.value() != 0) {
+          session->m_ec = write_ec;
           onRequestComplete(session);
           return;
         }
-      }
 
-      asio::async_write(
-          session->m_sock, asio::buffer(session->m_request),
-          [this, session](const asio::error_code& write_ec, std::size_t /* bytes_transferred */) {
-            if (write_ec.value() != 0) {
-              session->m_ec = write_ec;
-              onRequestComplete(session);
-              return;
-            }
-
-            {
-              std::unique_lock<std::mutex> cancel_lock{session->m_cancel_guard};
-              if (session->m_was_cancelled) {
-                onRequestComplete(session);
-                return;
-              }
-            }
-
-            asio::async_read_until(
-                session->m_sock, session->m_response_buf, '\n',
-                [this, session](const asio::error_code& read_ec, std::size_t /* bytes_transferred */) {
-                  if (read_ec.value() != 0) {
-                    session->m_ec = read_ec;
-                  } else {
-                    std::istream strm{&session->m_response_buf};
-                    std::getline(strm, session->m_response);
-                  }
-
-                  onRequestComplete(session);
-                });
-          });
-    });
+        if (!session->m_state.Advance(RequestState::Writing, RequestState::Reading)) {
+          onRequestComplete(session);
+          return;
+        }
+
+        startStep(session, m_deadlines.read);
+        receiveResponse(session);
+      };
+
+      startStep(session, m_deadlines.write);
+      asio::async_write(session->m_sock, session->m_request_msg.Buffers(),
+                        MakeCustomAllocHandler(session->m_handler_memory, on_write));
+    };
+
+    startStep(session, m_deadlines.connect);
+    if (!session->m_state.Advance(RequestState::Idle, RequestState::Connecting)) {
+      // Cancelled as soon as it was made visible to cancelRequest().
+      onRequestComplete(session);
+      return;
+    }
+    session->m_sock.async_connect(session->m_ep,
+                                  MakeCustomAllocHandler(session->m_handler_memory, on_connect));
   }
 
   // Cancels the request.
@@ -123,11 +202,11 @@ public:
     std::unique_lock<std::mutex> lock{m_active_sessions_guard};
 
     auto it = m_active_sessions.find(request_id);
-    if (it != m_active_sessions.end()) {
-      std::unique_lock<std::mutex> cancel_lock{it->second->m_cancel_guard};
-
-      it->second->m_was_cancelled = true;
-      it->second->m_sock.cancel();
+    if (it != m_active_sessions.end() && it->second->m_state.BeginCancel()) {
+      // The request cannot complete before EndCancel(), the socket is still the one of the request.
+      asio::error_code ignored_ec;
+      it->second->m_sock.cancel(ignored_ec);
+      it->second->m_state.EndCancel();
     }
   }
 
@@ -142,11 +221,80 @@ public:
   }
 
 private:
-  void onRequestComplete(std::shared_ptr<Session> session) {
+  // Deadline `timeout` from now, none if the timeout is zero.
+  static std::chrono::steady_clock::time_point Deadline(std::chrono::steady_clock::duration timeout) {
+    if (timeout == std::chrono::steady_clock::duration::zero()) {
+      return std::chrono::steady_clock::time_point::max();
+    }
+    return std::chrono::steady_clock::now() + timeout;
+  }
+
+  // Arms the deadline of the next step of the request, bounded by the deadline of the whole request.
+  void startStep(const std::shared_ptr<Session>& session, std::chrono::steady_clock::duration timeout) {
+    auto deadline = std::min(Deadline(timeout), session->m_request_deadline);
+    session->m_deadline.store(deadline, std::memory_order_release);
+
+    if (deadline != std::chrono::steady_clock::time_point::max()) {
+      m_timers.Arm(session->m_deadline_timer, deadline, session);
+    }
+  }
+
+  // Cancels the request if the deadline of its current step has passed. The timer may report a deadline the
+  // request has already moved past, or one of a previous request of the session: the generation is read
+  // before the deadline, so a deadline of an earlier request is never applied to a later one.
+  void onDeadline(std::shared_ptr<Session> session) {
+    std::uint32_t generation = session->m_state.Generation();
+    if (std::chrono::steady_clock::now() < session->m_deadline.load(std::memory_order_acquire)) return;
+    if (!session->m_state.BeginCancel(generation)) return;
+
+    session->m_timed_out = true;
+
+    asio::error_code ignored_ec;
+    session->m_sock.cancel(ignored_ec);
+    session->m_state.EndCancel();
+  }
+
+  // Reads the response, framed according to the protocol of the request.
+  void receiveResponse(std::shared_ptr<Session> session) {
+    if (session->m_protocol == WireProtocol::Binary) {
+      auto on_read = [this, session](const asio::error_code& read_ec) {
+        if (read_ec.value() != 0) {
+          session->m_ec = read_ec;
+        } else if (session->m_binary_reader.Header().request_id != session->m_id) {
+          // The response answers another request, the connection is out of sync.
+          session->m_ec = asio::error::invalid_argument;
+        }
+
+        // The payload stays in the reader's buffer until the request is complete.
+        onRequestComplete(session, session->m_binary_reader.Payload());
+      };
+
+      session->m_binary_reader.AsyncRead(session->m_sock,
+                                         MakeCustomAllocHandler(session->m_handler_memory, on_read));
+      return;
+    }
+
+    auto on_read = [this, session](const asio::error_code& read_ec, FrameView response) {
+      if (read_ec.value() != 0) session->m_ec = read_ec;
+      onRequestComplete(session, response);
+    };
+
+    AsyncReadFrame(session->m_sock, session->m_response_reader,
+                   MakeCustomAllocHandler(session->m_handler_memory, on_read));
+  }
+
+  // Completes the request. `response` points into the receive buffer of the session, it is only used if the
+  // request succeeded.
+  void onRequestComplete(std::shared_ptr<Session> session, FrameView response = FrameView{}) {
+    // The request is over, it cannot be cancelled any more and a deadline expiring from now on is ignored.
+    bool cancelled = session->m_state.Finish();
+    m_timers.Cancel(session->m_deadline_timer);
+
     // Shutting down the connection. This method may fail in case socket is not connected. We don't care about
     // the error code if this function fails.
     asio::error_code ignored_ec;
     session->m_sock.shutdown(asio::ip::tcp::socket::shutdown_both, ignored_ec);
+    session->m_sock.close(ignored_ec);
 
     {  // Remove session from the map of active sessions.
       std::unique_lock<std::mutex> lock{m_active_sessions_guard};
@@ -158,42 +306,77 @@ private:
     }
 
     asio::error_code ec;
-    if (session->m_ec.value() == 0 && session->m_was_cancelled) {
+    if (cancelled && session->m_timed_out) {
+      ec = asio::error::timed_out;
+    } else if (session->m_ec.value() == 0 && cancelled) {
       ec = asio::error::operation_aborted;
     } else {
       ec = session->m_ec;
     }
 
-    // Call the callback provided by the user.
-    session->m_callback(session->m_id, session->m_response, ec);
+    // Call the callback provided by the user, then release its context and the receive buffers.
+    session->m_callback(session->m_id, ec.value() == 0 ? response : FrameView{}, ec);
+    session->m_callback = nullptr;
+    session->m_binary_reader.Release();
+    session->m_response_reader.Clear();
+    session->m_response_reader.Release();
+
+    // The session is done, let the following requests reuse it.
+    m_sessions.Recycle(session);
   }
 
 private:
+  typedef RecyclingAllocator<std::pair<const unsigned int, std::shared_ptr<Session>>> SessionMapAllocator;
+
+  // Maximum number of idle sessions kept for reuse.
+  static const std::size_t MAX_FREE_SESSIONS = 1024;
+
+  // Resolution of the timer wheel the deadlines are tracked in.
+  static constexpr std::chrono::milliseconds TIMER_TICK{10};
+
+  WireProtocol m_protocol;  // Protocol the requests are sent with.
+  RequestDeadlines m_deadlines;
   asio::io_service m_ios;
-  std::map<int, std::shared_ptr<Session>> m_active_sessions;
+  TimerWheel m_timers;  // Deadlines of all the requests.
+  PayloadPool m_payload_buffers;   // Buffers binary responses are received in.
+  ObjectPool<Session> m_sessions;  // Recycled sessions.
+
+  // Active sessions by request id. Nodes of removed entries are recycled through m_active_sessions_nodes,
+  // which is guarded by m_active_sessions_guard like the map itself.
+  BlockFreeList m_active_sessions_nodes;
+  std::map<unsigned int, std::shared_ptr<Session>, std::less<unsigned int>, SessionMapAllocator>
+      m_active_sessions;
   std::mutex m_active_sessions_guard;
   std::unique_ptr<asio::io_service::work> m_work;
   std::unique_ptr<std::thread> m_thread;
 };
 
-void handler(unsigned int request_id, const std::string& response, const asio::error_code& ec) {
-  if (ec.value() == 0) {
-    logging::get()->info("Request #{} has completed. Response: {}", request_id, response);
-  } else if (ec == asio::error::operation_aborted) {
-    logging::get()->info("Request #{} has been cancelled by the user.", request_id);
-  } else {
-    logging::get()->error("Request #{} failed! Error code = {}. Error message: {}", request_id, ec.value(),
-                          ec.message());
-  }
+constexpr std::chrono::milliseconds AsyncTCPClient::TIMER_TICK;
 
-  return;
-}
-
-int main() {
+// Usage: 03_AsyncTCPClient [text|binary]
+int main(int argc, char* argv[]) {
   auto console = logging::setup();
 
+  // Reports the completion of a request. The logger is captured by the callback instead of being looked up
+  // in the logger registry on every completion.
+  auto handler = [console](unsigned int request_id, FrameView response, const asio::error_code& ec) {
+    if (ec.value() == 0) {
+      console->info("Request #{} has completed. Response: {}", request_id, response.ToString());
+    } else if (ec == asio::error::operation_aborted) {
+      console->info("Request #{} has been cancelled by the user.", request_id);
+    } else if (ec == asio::error::timed_out) {
+      console->info("Request #{} has timed out.", request_id);
+    } else {
+      console->error("Request #{} failed! Error code = {}. Error message: {}", request_id, ec.value(),
+                     ec.message());
+    }
+  };
+
+  WireProtocol protocol = WireProtocol::Text;
+  if (argc > 1 && std::strcmp(argv[1], "binary") == 0) protocol = WireProtocol::Binary;
+
   try {
-    AsyncTCPClient client;
+    AsyncTCPClient client{protocol};
 
     // Here we emulate the user's behavior ...
 
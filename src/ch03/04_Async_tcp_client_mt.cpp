@@ -1,47 +1,411 @@
+#include "../common/binary_frame.h"
+#include "../common/connection_pool.h"
+#include "../common/frame_reader.h"
+#include "../common/handler_allocator.h"
+#include "../common/inplace_function.h"
 #include "../common/logging.h"
+#include "../common/message_builder.h"
+#include "../common/object_pool.h"
+#include "../common/recycling_allocator.h"
+#include "../common/request_state.h"
+#include "../common/sharded_map.h"
+#include "../common/timer_wheel.h"
+#include <algorithm>
 #include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Callback called when a request is complete. It may carry its own context (e.g. a lambda capturing a few
+// pointers), which is stored in the session without any allocation. The response points into the buffer it
+// was received in and is only valid during the call; it is empty if the request failed.
+typedef InplaceFunction<void(unsigned int request_id, FrameView response, const asio::error_code& ec)>
+    Callback;
+
+class MultiplexedConnection;
+
+// Maximum time the steps of a request may take. A request that misses a deadline is cancelled and completes
+// with asio::error::timed_out. Zero means no limit.
+struct RequestDeadlines {
+  std::chrono::steady_clock::duration connect = std::chrono::seconds(5);
+  std::chrono::steady_clock::duration write = std::chrono::seconds(5);
+  std::chrono::steady_clock::duration read = std::chrono::seconds(30);
+  std::chrono::steady_clock::duration total = std::chrono::seconds(60);  // Whole request, from its start.
+};
 
-// Function pointer type that points to the callback function which is called when a request is complete.
-typedef void (*Callback)(unsigned int request_id, const std::string& response, const asio::error_code& ec);
+// Structure represents a context of a single request. Sessions are recycled by the client: a session object
+// and its buffers are reused by the following requests, so issuing a request does not allocate.
+struct Session : public std::enable_shared_from_this<Session> {
+  Session(PayloadPool& payload_pool, std::function<void(Session&)> on_deadline)
+      : m_mux{nullptr},
+        m_protocol{WireProtocol::Text},
+        m_binary_reader{payload_pool},
+        m_id{0},
+        m_deadline{std::chrono::steady_clock::time_point::max()},
+        m_deadline_timer{[this, on_deadline]() { on_deadline(*this); }},
+        m_timed_out{false} {}
+
+  // Prepares a fresh or recycled session for a new request.
+  void reset(unsigned int duration_sec, const std::string& raw_ip_address, unsigned short port_num,
+             unsigned int id, Callback&& callback, WireProtocol protocol) {
+    m_ep = asio::ip::tcp::endpoint{asio::ip::address::from_string(raw_ip_address), port_num};
+    m_protocol = protocol;
+
+    // Building the request in place reuses the capacity left by the previous request.
+    m_request.assign("EMULATE_LONG_CALC_OP ");
+    m_request += std::to_string(duration_sec);
+
+    // A binary request is the same command prefixed with a frame header instead of terminated by a newline.
+    m_request_msg.Clear();
+    if (m_protocol == WireProtocol::Binary) {
+      AppendBinaryFrame(m_request_msg, m_request_header, FrameType::Request, id, m_request.data(),
+                        m_request.size());
+    } else {
+      m_request += '\n';
+      m_request_msg.Append(m_request);
+    }
 
-// Structure represents a context of a single request.
-struct Session {
-  Session(asio::io_service& ios, const std::string& raw_ip_address, unsigned short port_num,
-          const std::string& request, unsigned int id, Callback callback)
-      : m_sock{ios},
-        m_ep{asio::ip::address::from_string(raw_ip_address), port_num},
-        m_request{request},
-        m_id{id},
-        m_callback{callback},
-        m_was_cancelled{false} {}
+    m_response_reader.Clear();
+    m_binary_reader.Release();
+    m_ec = asio::error_code{};
+    m_id = id;
+    m_callback = std::move(callback);
+    m_deadline.store(std::chrono::steady_clock::time_point::max(), std::memory_order_relaxed);
+    m_timed_out = false;
+    m_mux = nullptr;
+    m_state.Reset();
+  }
 
-  asio::ip::tcp::socket m_sock;  // Socket used for communication
-  asio::ip::tcp::endpoint m_ep;  // Remote endpoint.
-  std::string m_request;         // Request string;
+  ConnectionPool::SocketPtr m_sock;  // Socket used for communication, borrowed from the connection pool.
+  MultiplexedConnection* m_mux;      // Shared connection carrying the request in multiplexed mode.
+  asio::ip::tcp::endpoint m_ep;      // Remote endpoint.
+  WireProtocol m_protocol;           // Protocol the request is sent with.
+  std::string m_request;             // Request string;
+  unsigned char m_request_header[BINARY_FRAME_HEADER_SIZE];  // Frame header of a binary request.
+  MessageBuilder m_request_msg;                              // Request as written to the socket.
 
-  asio::streambuf m_response_buf;  // streambuf where the response will be stored.
-  std::string m_response;          // Response represented as a string.
+  FrameReader m_response_reader;      // Receive buffer a text response is framed in.
+  BinaryFrameReader m_binary_reader;  // Reads a binary response into a pooled buffer.
 
   // Contains the description of an error if one occurs during the request lifecycle.
   asio::error_code m_ec;
 
   unsigned int m_id;  // Unique ID assigned to the request.
 
-  // Pointer to the function to be called when the request completes.
+  // Function to be called when the request completes.
   Callback m_callback;
 
-  bool m_was_cancelled;
-  std::mutex m_cancel_guard;
+  std::chrono::steady_clock::time_point m_request_deadline;         // Deadline of the whole request.
+  std::atomic<std::chrono::steady_clock::time_point> m_deadline;  // Deadline of the current step.
+  TimerWheel::Timer m_deadline_timer;                               // Armed on the current step's deadline.
+  bool m_timed_out;  // Set by the canceller when the request is cancelled on a deadline.
+
+  // Step the request is at, and whether it has been cancelled.
+  RequestState m_state;
+
+  // Memory the asynchronous operations of the session are allocated from. A session never has more than
+  // one operation in flight.
+  HandlerMemory m_handler_memory;
+};
+
+// A connection to one endpoint shared by many in-flight requests. Requests are sent as binary frames, the
+// ones submitted while a write is in progress go out together in the next write, and every response is
+// matched back to its request by id, so each one completes as soon as it arrives whatever the order the
+// server answers in. The connection is (re)established on demand and only reads while requests are in
+// flight. All the state is owned by the connection's strand.
+class MultiplexedConnection {
+public:
+  // Called with the session of a completed request and its response, which points into the connection's
+  // receive buffer.
+  typedef std::function<void(std::shared_ptr<Session>, FrameView response)> CompletionHandler;
+
+  MultiplexedConnection(asio::io_service& ios, const asio::ip::tcp::endpoint& ep, PayloadPool& payload_pool,
+                        CompletionHandler on_complete)
+      : m_ios(ios),
+        m_ep(ep),
+        m_strand{ios},
+        m_sock{std::make_shared<asio::ip::tcp::socket>(ios)},
+        m_reader{payload_pool},
+        m_on_complete{std::move(on_complete)},
+        m_in_flight{0, std::hash<unsigned int>{}, std::equal_to<unsigned int>{},
+                    InFlightAllocator{m_in_flight_nodes}},
+        m_connected{false},
+        m_connecting{false},
+        m_writing{false},
+        m_reading{false},
+        m_generation{0} {}
+  MultiplexedConnection(const MultiplexedConnection& src) = delete;
+  MultiplexedConnection& operator=(const MultiplexedConnection& rhs) = delete;
+
+  // Queues a request for sending. The session is handed to the completion handler once its response has
+  // arrived or the request has failed. A multiplexed session has no operation of its own, the post is
+  // allocated from its memory.
+  void Submit(std::shared_ptr<Session> session) {
+    HandlerMemory& memory = session->m_handler_memory;
+    m_strand.post(MakeCustomAllocHandler(memory, [this, session]() {
+      m_queue.push_back(session);
+
+      // A connection that sat idle may have been closed by the server in the meantime. A pending read would
+      // see it, and the peek must not race with it.
+      if (m_connected && !m_writing && !m_reading && m_in_flight.empty() &&
+          !ConnectionPool::IsHealthy(*m_sock)) {
+        Reset();
+      }
+
+      if (!m_connected) {
+        Connect();
+      } else {
+        Write();
+      }
+    }));
+  }
+
+  // Completes the request as cancelled if it is still pending. The connection stays open, a late response
+  // to the request is dropped.
+  void Cancel(std::shared_ptr<Session> session) {
+    unsigned int id = session->m_id;
+    m_strand.post([this, session, id]() {
+      auto queued = std::find(m_queue.begin(), m_queue.end(), session);
+      if (queued != m_queue.end() && session->m_id == id) {
+        m_queue.erase(queued);
+        m_on_complete(session, FrameView{});
+        return;
+      }
+
+      auto it = m_in_flight.find(id);
+      if (it != m_in_flight.end() && it->second == session) {
+        m_in_flight.erase(it);
+        m_on_complete(session, FrameView{});
+      }
+    });
+  }
+
+private:
+  void Connect() {
+    if (m_connecting) return;
+    m_connecting = true;
+
+    asio::error_code ec;
+    m_sock->open(m_ep.protocol(), ec);
+    if (ec) {
+      m_connecting = false;
+      Fail(ec);
+      return;
+    }
+
+    std::uint64_t generation = m_generation;
+    m_sock->async_connect(m_ep, m_strand.wrap([this, generation](const asio::error_code& connect_ec) {
+      onConnected(generation, connect_ec);
+    }));
+  }
+
+  void onConnected(std::uint64_t generation, const asio::error_code& ec) {
+    if (generation != m_generation) return;
+    m_connecting = false;
+
+    if (ec) {
+      Fail(ec);
+      return;
+    }
+
+    m_connected = true;
+    Write();
+  }
+
+  // Sends all the queued requests with a single write. They are copied into the connection's own buffer,
+  // so a request may complete (and its session be recycled) while the write is still in progress.
+  void Write() {
+    if (!m_connected || m_writing || m_queue.empty()) return;
+
+    m_write_buf.clear();
+    for (auto& session : m_queue) {
+      for (const auto& buf : session->m_request_msg.Buffers()) {
+        const char* data = asio::buffer_cast<const char*>(buf);
+        m_write_buf.insert(m_write_buf.end(), data, data + asio::buffer_size(buf));
+      }
+      m_in_flight[session->m_id] = session;
+    }
+    m_queue.clear();
+
+    // The strand wraps the custom allocation, so that the completion it dispatches to the strand is allocated
+    // from the same memory as the operation.
+    // The handler keeps the socket alive: once the connection is reset, the write may still go on with the
+    // socket it was started on.
+    m_writing = true;
+    std::uint64_t generation = m_generation;
+    SocketPtr sock = m_sock;
+    asio::async_write(*sock, asio::buffer(m_write_buf),
+                      m_strand.wrap(MakeCustomAllocHandler(
+                          m_write_memory, [this, generation, sock](const asio::error_code& ec, std::size_t) {
+                            onWritten(generation, ec);
+                          })));
+
+    Read();
+  }
+
+  void onWritten(std::uint64_t generation, const asio::error_code& ec) {
+    m_writing = false;
+    if (generation != m_generation) {
+      // The write buffer is free again, the requests queued for the new connection can go.
+      Write();
+      return;
+    }
+
+    if (ec) {
+      Fail(ec);
+      return;
+    }
+
+    Write();
+  }
+
+  void Read() {
+    if (!m_connected || m_reading || m_in_flight.empty()) return;
+    m_reading = true;
+
+    std::uint64_t generation = m_generation;
+    SocketPtr sock = m_sock;
+    m_reader.AsyncRead(*sock, m_strand.wrap(MakeCustomAllocHandler(
+                                  m_read_memory, [this, generation, sock](const asio::error_code& ec) {
+                                    onRead(generation, ec);
+                                  })));
+  }
+
+  void onRead(std::uint64_t generation, const asio::error_code& ec) {
+    m_reading = false;
+    if (generation != m_generation) {
+      // The reader is free again, the responses of the new connection can be read.
+      m_reader.Release();
+      Read();
+      return;
+    }
+
+    if (ec) {
+      Fail(ec);
+      return;
+    }
+
+    // Responses to cancelled requests are no longer in the map and are dropped.
+    auto it = m_in_flight.find(static_cast<unsigned int>(m_reader.Header().request_id));
+    if (it != m_in_flight.end()) {
+      std::shared_ptr<Session> session = std::move(it->second);
+      m_in_flight.erase(it);
+
+      m_on_complete(session, m_reader.Payload());
+    }
+
+    m_reader.Release();
+    Read();
+  }
+
+  // Closes the connection and takes a new socket for the next one. The read and write still pending on the
+  // old socket keep the reader and the write buffer until their handlers, which only release them, are
+  // called: an operation past its first step is not aborted by the close and must not go on with the new
+  // connection.
+  void Reset() {
+    ++m_generation;
+    m_connected = m_connecting = false;
+
+    asio::error_code ignored_ec;
+    m_sock->shutdown(asio::ip::tcp::socket::shutdown_both, ignored_ec);
+    m_sock->close(ignored_ec);
+    m_sock = std::make_shared<asio::ip::tcp::socket>(m_ios);
+    if (!m_reading) m_reader.Release();
+  }
+
+  // Closes the connection and fails all the requests it carries.
+  void Fail(const asio::error_code& ec) {
+    Reset();
+
+    std::vector<std::shared_ptr<Session>> failed{m_queue.begin(), m_queue.end()};
+    for (auto& entry : m_in_flight) failed.push_back(std::move(entry.second));
+    m_queue.clear();
+    m_in_flight.clear();
+
+    for (auto& session : failed) {
+      session->m_ec = ec;
+      m_on_complete(session, FrameView{});
+    }
+  }
+
+private:
+  typedef std::shared_ptr<asio::ip::tcp::socket> SocketPtr;
+
+  asio::io_service& m_ios;
+  asio::ip::tcp::endpoint m_ep;
+  asio::io_service::strand m_strand;  // Serializes all the handlers of the connection.
+  SocketPtr m_sock;                   // Socket of the current connection, a new one per connection.
+  BinaryFrameReader m_reader;  // Reads the responses into pooled buffers.
+  CompletionHandler m_on_complete;
+
+  typedef RecyclingAllocator<std::pair<const unsigned int, std::shared_ptr<Session>>> InFlightAllocator;
+
+  std::deque<std::shared_ptr<Session>> m_queue;  // Requests waiting to be sent.
+
+  // Sent requests by id. Nodes of removed entries are recycled through m_in_flight_nodes, which belongs to
+  // the strand like the map itself.
+  BlockFreeList m_in_flight_nodes;
+  std::unordered_map<unsigned int, std::shared_ptr<Session>, std::hash<unsigned int>,
+                     std::equal_to<unsigned int>, InFlightAllocator>
+      m_in_flight;
+
+  std::vector<char> m_write_buf;  // Requests the write covers.
+
+  bool m_connected;
+  bool m_connecting;
+  bool m_writing;  // A write is pending, possibly on the socket of an earlier connection.
+  bool m_reading;  // Same for a read.
+  std::uint64_t m_generation;  // Incremented when the socket is closed, stale handlers check it.
+
+  // Memory the reads and writes are allocated from, one of each may be in flight.
+  HandlerMemory m_read_memory;
+  HandlerMemory m_write_memory;
+};
+
+// Settings of the client.
+struct ClientConfig {
+  // Connections carrying one request at a time, kept warm between requests.
+  ConnectionPool::Config pool;
+
+  // Protocol the requests are sent with.
+  WireProtocol protocol = WireProtocol::Text;
+
+  // When non-zero, the requests to an endpoint are multiplexed over this many shared connections instead of
+  // taking a connection each. Responses are matched by request id, so the binary protocol is used and the
+  // ids of the requests in flight must be unique.
+  std::size_t multiplexed_connections = 0;
+
+  // Deadlines of every request. A multiplexed request has no connect and write steps of its own: it is
+  // bounded by the read deadline, counted from its submission, and by the total one.
+  RequestDeadlines deadlines;
 };
 
 class AsyncTCPClient {
 public:
-  AsyncTCPClient(unsigned char num_of_threads) {
+  AsyncTCPClient(unsigned char num_of_threads, const ClientConfig& config = ClientConfig{})
+      : m_config(config),
+        m_pool{m_ios, config.pool},
+        m_timers{m_ios, TIMER_TICK},
+        m_payload_buffers{PayloadBufferFactory(), MAX_FREE_SESSIONS},
+        m_sessions{[this]() {
+                     return std::make_shared<Session>(m_payload_buffers, [this](Session& session) {
+                       onDeadline(session.shared_from_this());
+                     });
+                   },
+                   MAX_FREE_SESSIONS},
+        m_next_mux{0} {
+    if (m_config.multiplexed_connections != 0) m_config.protocol = WireProtocol::Binary;
+
     m_work.reset(new asio::io_service::work{m_ios});
 
     for (unsigned char i = 1; i <= num_of_threads; ++i) {
@@ -57,81 +421,78 @@ public:
 
   void emulateLongComputationOp(unsigned int duration_sec, const std::string& raw_ip_address,
                                 unsigned short port_num, Callback callback, unsigned int request_id) {
-    // Preparing the request string.
-    std::string request = "EMULATE_LONG_CALC_OP " + std::to_string(duration_sec) + "\n";
+    // Take a recycled session and prepare the request in it.
+    auto session = m_sessions.Acquire();
+    session->reset(duration_sec, raw_ip_address, port_num, request_id, std::move(callback),
+                   m_config.protocol);
+    session->m_request_deadline = Deadline(m_config.deadlines.total);
+
+    if (m_config.multiplexed_connections != 0) {
+      // The request shares a connection with others, no socket setup is needed per request.
+      session->m_mux = getMultiplexedConnection(session->m_ep);
+      m_active_sessions.Insert(request_id, session);
+      startStep(session, m_config.deadlines.read);
+      if (!session->m_state.Advance(RequestState::Idle, RequestState::Reading)) {
+        // Cancelled as soon as it was made visible to cancelRequest().
+        onRequestComplete(session);
+        return;
+      }
+      session->m_mux->Submit(session);
+      return;
+    }
 
-    auto session = std::make_shared<Session>(m_ios, raw_ip_address, port_num, request, request_id, callback);
-    session->m_sock.open(session->m_ep.protocol());
+    // Borrow a connection to the server from the pool. A warm connection skips the connect step.
+    bool connected = false;
+    session->m_sock = m_pool.Acquire(session->m_ep, connected, session->m_ec);
+    if (!session->m_sock) {
+      // Too many connections to this server are already open, or a socket could not be opened.
+      session->m_callback(session->m_id, FrameView{}, session->m_ec);
+      session->m_callback = nullptr;
+      m_sessions.Recycle(session);
+      return;
+    }
 
-    {  // Add new session to the list of active sessions so that we can access it if the user decides to
-       // cancel the corresponding request before it completes. Because active sessions list can be accessed
-       // from multiple threads, we guard it with a mutex to avoid data corruption.
-      std::unique_lock<std::mutex> lock{m_active_sessions_guard};
-      m_active_sessions[request_id] = session;
+    // Add new session to the registry of active sessions so that we can access it if the user decides to
+    // cancel the corresponding request before it completes. The registry is accessed from multiple threads,
+    // it is sharded by request id so that requests only contend when they fall into the same shard.
+    m_active_sessions.Insert(request_id, session);
+
+    if (connected) {
+      sendRequest(session, RequestState::Idle);
+      return;
     }
 
-    session->m_sock.async_connect(session->m_ep, [this, session](const asio::error_code& connect_ec) {
+    // Every handler is wrapped so that the operation it completes is allocated from the session's memory.
+    auto on_connect = [this, session](const asio::error_code& connect_ec) {
       if (connect_ec.value() != 0) {
         session->m_ec = connect_ec;
         onRequestComplete(session);
         return;
       }
 
-      {
-        std::unique_lock<std::mutex> cancel_lock{session->m_cancel_guard};
-        if (session->m_was_cancelled) {
-          onRequestComplete(session);
-          return;
-        }
-      }
+      sendRequest(session, RequestState::Connecting);
+    };
 
-      asio::async_write(
-          session->m_sock, asio::buffer(session->m_request),
-          [this, session](const asio::error_code& write_ec, std::size_t /* bytes_transferred */) {
-            if (write_ec.value() != 0) {
-              session->m_ec = write_ec;
-              onRequestComplete(session);
-              return;
-            }
-
-            {
-              std::unique_lock<std::mutex> cancel_lock{session->m_cancel_guard};
-              if (session->m_was_cancelled) {
-                onRequestComplete(session);
-                return;
-              }
-            }
-
-            asio::async_read_until(
-                session->m_sock, session->m_response_buf, '\n',
-                [this, session](const asio::error_code& read_ec, std::size_t /* bytes_transferred */) {
-                  if (read_ec.value() != 0) {
-                    session->m_ec = read_ec;
-                  } else {
-                    std::istream strm{&session->m_response_buf};
-                    std::getline(strm, session->m_response);
-                  }
-
-                  onRequestComplete(session);
-                });
-          });
-    });
+    startStep(session, m_config.deadlines.connect);
+    if (!session->m_state.Advance(RequestState::Idle, RequestState::Connecting)) {
+      onRequestComplete(session);
+      return;
+    }
+    session->m_sock->async_connect(session->m_ep,
+                                   MakeCustomAllocHandler(session->m_handler_memory, on_connect));
   }
 
   // Cancels the request.
   void cancelRequest(unsigned int request_id) {
-    std::unique_lock<std::mutex> lock{m_active_sessions_guard};
-
-    auto it = m_active_sessions.find(request_id);
-    if (it != m_active_sessions.end()) {
-      std::unique_lock<std::mutex> cancel_lock{it->second->m_cancel_guard};
-
-      it->second->m_was_cancelled = true;
-      it->second->m_sock.cancel();
-    }
+    m_active_sessions.Visit(request_id, [this](std::shared_ptr<Session>& session) {
+      if (session->m_state.BeginCancel()) abortRequest(session);
+    });
   }
 
   void close() {
+    // Close the warm connections kept in the pool.
+    m_pool.Clear();
+
     // Destroy work object. This allows the I/O thread to
     // exits the event loop when there are no more pending
     // asynchronous operations.
@@ -144,58 +505,222 @@ public:
   }
 
 private:
-  void onRequestComplete(std::shared_ptr<Session> session) {
-    // Shutting down the connection. This method may fail in case socket is not connected. We don't care about
-    // the error code if this function fails.
-    asio::error_code ignored_ec;
-    session->m_sock.shutdown(asio::ip::tcp::socket::shutdown_both, ignored_ec);
+  // Picks one of the shared connections to the endpoint, round robin.
+  MultiplexedConnection* getMultiplexedConnection(const asio::ip::tcp::endpoint& ep) {
+    std::unique_lock<std::mutex> lock{m_mux_guard};
+
+    auto& conns = m_mux_connections[ep];
+    if (conns.empty()) {
+      for (std::size_t i = 0; i < m_config.multiplexed_connections; ++i) {
+        conns.emplace_back(new MultiplexedConnection{m_ios, ep, m_payload_buffers,
+                                                     [this](std::shared_ptr<Session> session,
+                                                            FrameView response) {
+                                                       onRequestComplete(session, response);
+                                                     }});
+      }
+    }
 
-    {  // Remove session from the map of active sessions.
-      std::unique_lock<std::mutex> lock{m_active_sessions_guard};
+    return conns[m_next_mux++ % conns.size()].get();
+  }
+
+  // Writes the request once the connection is established, `step` being the one the request is at.
+  void sendRequest(std::shared_ptr<Session> session, RequestState::State step) {
+    if (!session->m_state.Advance(step, RequestState::Writing)) {
+      // The request has been cancelled meanwhile.
+      onRequestComplete(session);
+      return;
+    }
+
+    auto on_write = [this, session](const asio::error_code& write_ec, std::size_t /* bytes_transferred */) {
+      if (write_ec.value() != 0) {
+        session->m_ec = write_ec;
+        onRequestComplete(session);
+        return;
+      }
 
-      auto it = m_active_sessions.find(session->m_id);
-      if (it != m_active_sessions.end()) {
-        m_active_sessions.erase(it);
+      if (!session->m_state.Advance(RequestState::Writing, RequestState::Reading)) {
+        onRequestComplete(session);
+        return;
       }
+
+      startStep(session, m_config.deadlines.read);
+      receiveResponse(session);
+    };
+
+    startStep(session, m_config.deadlines.write);
+    asio::async_write(*session->m_sock, session->m_request_msg.Buffers(),
+                      MakeCustomAllocHandler(session->m_handler_memory, on_write));
+  }
+
+  // Deadline `timeout` from now, none if the timeout is zero.
+  static std::chrono::steady_clock::time_point Deadline(std::chrono::steady_clock::duration timeout) {
+    if (timeout == std::chrono::steady_clock::duration::zero()) {
+      return std::chrono::steady_clock::time_point::max();
     }
+    return std::chrono::steady_clock::now() + timeout;
+  }
+
+  // Arms the deadline of the next step of the request, bounded by the deadline of the whole request.
+  void startStep(const std::shared_ptr<Session>& session, std::chrono::steady_clock::duration timeout) {
+    auto deadline = std::min(Deadline(timeout), session->m_request_deadline);
+    session->m_deadline.store(deadline, std::memory_order_release);
+
+    if (deadline != std::chrono::steady_clock::time_point::max()) {
+      m_timers.Arm(session->m_deadline_timer, deadline, session);
+    }
+  }
+
+  // Cancels the request if the deadline of its current step has passed. The timer may report a deadline the
+  // request has already moved past, or one of a previous request of the session: the generation is read
+  // before the deadline, so a deadline of an earlier request is never applied to a later one.
+  void onDeadline(std::shared_ptr<Session> session) {
+    std::uint32_t generation = session->m_state.Generation();
+    if (std::chrono::steady_clock::now() < session->m_deadline.load(std::memory_order_acquire)) return;
+    if (!session->m_state.BeginCancel(generation)) return;
+
+    session->m_timed_out = true;
+    abortRequest(session);
+  }
+
+  // Aborts the operation in flight of a request won with BeginCancel(). The request cannot complete before
+  // EndCancel(), so its socket or connection is still the one of the request.
+  void abortRequest(const std::shared_ptr<Session>& session) {
+    if (session->m_mux != nullptr) {
+      session->m_mux->Cancel(session);
+    } else {
+      asio::error_code ignored_ec;
+      session->m_sock->cancel(ignored_ec);
+    }
+    session->m_state.EndCancel();
+  }
+
+  // Reads the response, framed according to the protocol of the request.
+  void receiveResponse(std::shared_ptr<Session> session) {
+    if (session->m_protocol == WireProtocol::Binary) {
+      auto on_read = [this, session](const asio::error_code& read_ec) {
+        if (read_ec.value() != 0) {
+          session->m_ec = read_ec;
+        } else if (session->m_binary_reader.Header().request_id != session->m_id) {
+          // The response answers another request, the connection is out of sync.
+          session->m_ec = asio::error::invalid_argument;
+        }
+
+        // The payload stays in the reader's buffer until the request is complete.
+        onRequestComplete(session, session->m_binary_reader.Payload());
+      };
+
+      session->m_binary_reader.AsyncRead(*session->m_sock,
+                                         MakeCustomAllocHandler(session->m_handler_memory, on_read));
+      return;
+    }
+
+    auto on_read = [this, session](const asio::error_code& read_ec, FrameView response) {
+      if (read_ec.value() != 0) session->m_ec = read_ec;
+      onRequestComplete(session, response);
+    };
+
+    AsyncReadFrame(*session->m_sock, session->m_response_reader,
+                   MakeCustomAllocHandler(session->m_handler_memory, on_read));
+  }
+
+  // Completes the request. `response` points into the receive buffer of the session (or of the shared
+  // connection in multiplexed mode), it is only used if the request succeeded.
+  void onRequestComplete(std::shared_ptr<Session> session, FrameView response = FrameView{}) {
+    // The request is over, it cannot be cancelled any more and a deadline expiring from now on is ignored.
+    bool cancelled = session->m_state.Finish();
+    m_timers.Cancel(session->m_deadline_timer);
+
+    // Give the connection back to the pool. Only a connection whose request/response exchange completed
+    // cleanly is kept for reuse, any other is shut down and closed by the pool.
+    // Multiplexed requests have no connection of their own.
+    if (session->m_sock) {
+      bool reusable = session->m_ec.value() == 0 && !cancelled;
+      m_pool.Release(session->m_ep, session->m_sock, reusable);
+    }
+
+    // Remove session from the registry of active sessions.
+    m_active_sessions.Erase(session->m_id);
 
     asio::error_code ec;
-    if (session->m_ec.value() == 0 && session->m_was_cancelled) {
+    if (cancelled && session->m_timed_out) {
+      ec = asio::error::timed_out;
+    } else if (session->m_ec.value() == 0 && cancelled) {
       ec = asio::error::operation_aborted;
     } else {
       ec = session->m_ec;
     }
 
-    // Call the callback provided by the user.
-    session->m_callback(session->m_id, session->m_response, ec);
+    // Call the callback provided by the user, then release its context and the receive buffers.
+    session->m_callback(session->m_id, ec.value() == 0 ? response : FrameView{}, ec);
+    session->m_callback = nullptr;
+    session->m_binary_reader.Release();
+
+    // The text receive buffer stays with the session. Given back, it would join the buffer cache of this I/O
+    // thread while the next request may take one on another thread, and the caches of the threads receiving
+    // more responses than they start would run dry.
+    session->m_response_reader.Clear();
+
+    // The session is done, let the following requests reuse it.
+    session->m_sock.reset();
+    m_sessions.Recycle(session);
   }
 
 private:
+  // Maximum number of idle sessions kept for reuse.
+  static const std::size_t MAX_FREE_SESSIONS = 1024;
+
+  // Resolution of the timer wheel the deadlines are tracked in.
+  static constexpr std::chrono::milliseconds TIMER_TICK{10};
+
+  ClientConfig m_config;
   asio::io_service m_ios;
-  std::map<int, std::shared_ptr<Session>> m_active_sessions;
-  std::mutex m_active_sessions_guard;
+  ConnectionPool m_pool;           // Warm connections to the servers, keyed by endpoint.
+  TimerWheel m_timers;             // Deadlines of all the requests.
+  PayloadPool m_payload_buffers;   // Buffers binary responses are received in.
+  ObjectPool<Session> m_sessions;  // Recycled sessions.
+  ShardedMap<unsigned int, std::shared_ptr<Session>> m_active_sessions;
+
+  // Shared connections of the multiplexed mode, by endpoint. Never removed, they reconnect on demand.
+  std::map<asio::ip::tcp::endpoint, std::vector<std::unique_ptr<MultiplexedConnection>>> m_mux_connections;
+  std::size_t m_next_mux;  // Protected by m_mux_guard.
+  std::mutex m_mux_guard;
+
   std::unique_ptr<asio::io_service::work> m_work;
   std::list<std::unique_ptr<std::thread>> m_threads;
 };
 
-void handler(unsigned int request_id, const std::string& response, const asio::error_code& ec) {
-  if (ec.value() == 0) {
-    logging::get()->info("Request #{} has completed. Response: {}", request_id, response);
-  } else if (ec == asio::error::operation_aborted) {
-    logging::get()->info("Request #{} has been cancelled by the user.", request_id);
-  } else {
-    logging::get()->error("Request #{} failed! Error code = {}. Error message: {}", request_id, ec.value(),
-                          ec.message());
-  }
+constexpr std::chrono::milliseconds AsyncTCPClient::TIMER_TICK;
 
-  return;
-}
-
-int main() {
+// The benchmarks (src/bench) include the client without its main().
+#ifndef RECIPE_NO_MAIN
+// Usage: 04_AsyncTCPClientMT [text|binary|multiplexed]
+int main(int argc, char* argv[]) {
   auto console = logging::setup();
 
+  // Reports the completion of a request. The logger is captured by the callback instead of being looked up
+  // in the logger registry on every completion.
+  auto handler = [console](unsigned int request_id, FrameView response, const asio::error_code& ec) {
+    if (ec.value() == 0) {
+      console->info("Request #{} has completed. Response: {}", request_id, response.ToString());
+    } else if (ec == asio::error::operation_aborted) {
+      console->info("Request #{} has been cancelled by the user.", request_id);
+    } else if (ec == asio::error::timed_out) {
+      console->info("Request #{} has timed out.", request_id);
+    } else {
+      console->error("Request #{} failed! Error code = {}. Error message: {}", request_id, ec.value(),
+                     ec.message());
+    }
+  };
+
+  ClientConfig config;
+  if (argc > 1 && std::strcmp(argv[1], "binary") == 0) {
+    config.protocol = WireProtocol::Binary;
+  } else if (argc > 1 && std::strcmp(argv[1], "multiplexed") == 0) {
+    config.multiplexed_connections = 2;
+  }
+
   try {
-    AsyncTCPClient client{4};
+    AsyncTCPClient client{4, config};
 
     // Here we emulate the user's behavior ...
 
@@ -229,3 +754,4 @@ int main() {
 
   return 0;
 }
+#endif /* RECIPE_NO_MAIN */
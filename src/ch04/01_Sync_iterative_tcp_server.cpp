@@ -1,38 +1,79 @@
+#include "../common/arena.h"
+#include "../common/binary_frame.h"
 #include "../common/logging.h"
+#include "../common/message_builder.h"
 #include <asio.hpp>
 #include <atomic>
 #include <chrono>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <thread>
 
 class Service {
 public:
-  Service() = default;
+  explicit Service(PayloadPool& payload_pool) : m_payload_pool(payload_pool) {}
 
   void HandleClient(asio::ip::tcp::socket& sock) {
     try {
-      asio::streambuf request;
-      asio::read_until(sock, request, '\n');
-
-      // Emulate request processing.
-      int i = 0;
-      while (i != 1000000) ++i;
-      std::this_thread::sleep_for(std::chrono::milliseconds(500));
-
-      // Sending response.
-      std::string response = "Response\n";
-      asio::write(sock, asio::buffer(response));
+      // Clients speaking the binary protocol are recognized by the first byte of their request.
+      if (DetectProtocol(sock) == WireProtocol::Binary) {
+        HandleBinaryRequest(sock);
+      } else {
+        HandleTextRequest(sock);
+      }
     } catch (asio::system_error& e) {
       logging::get()->error("Error occurred! Error code = {}. Message: {}", e.code().value(), e.what());
     }
   }
+
+private:
+  void HandleTextRequest(asio::ip::tcp::socket& sock) {
+    // The request is received into an arena of this thread, which goes back to the thread's cache with it.
+    PooledArena arena = ArenaCache::Acquire();
+    asio::basic_streambuf<ArenaAllocator<char>> request{std::numeric_limits<std::size_t>::max(),
+                                                        ArenaAllocator<char>{*arena}};
+    asio::read_until(sock, request, '\n');
+
+    ProcessRequest();
+
+    // Sending response.
+    std::string response = "Response\n";
+    asio::write(sock, asio::buffer(response));
+  }
+
+  void HandleBinaryRequest(asio::ip::tcp::socket& sock) {
+    BinaryFrameReader request{m_payload_pool, BINARY_FRAME_MAX_REQUEST_PAYLOAD};
+    request.Read(sock);
+
+    ProcessRequest();
+
+    // Sending response, it carries the id of the request it answers.
+    std::string response = "Response";
+    unsigned char header[BINARY_FRAME_HEADER_SIZE];
+    MessageBuilder msg;
+    AppendBinaryFrame(msg, header, FrameType::Response, request.Header().request_id, response.data(),
+                      response.size());
+    asio::write(sock, msg.Buffers());
+  }
+
+  // Emulate request processing.
+  static void ProcessRequest() {
+    int i = 0;
+    while (i != 1000000) ++i;
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  }
+
+private:
+  PayloadPool& m_payload_pool;
 };
 
 class Acceptor {
 public:
   Acceptor(asio::io_service& ios, unsigned short port_num)
-      : m_ios{ios}, m_acceptor{m_ios, asio::ip::tcp::endpoint(asio::ip::address_v4::any(), port_num)} {
+      : m_ios{ios},
+        m_acceptor{m_ios, asio::ip::tcp::endpoint(asio::ip::address_v4::any(), port_num)},
+        m_payload_pool{PayloadBufferFactory(), 1} {
     m_acceptor.listen();
   }
 
@@ -40,13 +81,14 @@ public:
     asio::ip::tcp::socket sock{m_ios};
     m_acceptor.accept(sock);
 
-    Service svc;
+    Service svc{m_payload_pool};
     svc.HandleClient(sock);
   }
 
 private:
   asio::io_service& m_ios;
   asio::ip::tcp::acceptor m_acceptor;
+  PayloadPool m_payload_pool;  // Clients are served one at a time, a single buffer is enough.
 };
 
 class Server {
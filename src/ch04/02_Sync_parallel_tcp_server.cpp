@@ -1,45 +1,99 @@
+#include "../common/arena.h"
+#include "../common/binary_frame.h"
 #include "../common/logging.h"
+#include "../common/message_builder.h"
+#include "../common/thread_pool.h"
 #include <asio.hpp>
 #include <atomic>
+#include <cstring>
+#include <limits>
 #include <memory>
 #include <thread>
 
+// Settings of the server.
+struct ServerConfig {
+  // Threads serving the clients, one connection at a time each. Requests block for a while (see
+  // Service::ProcessRequest), so there are many more workers than CPUs.
+  unsigned int num_workers = 64;
+
+  // Accepted connections waiting for a worker.
+  std::size_t queue_capacity = 256;
+
+  // What happens to a new connection when all the workers are busy and the queue is full: Block stops
+  // accepting until a worker is free (new clients wait in the listen backlog), Reject closes the new
+  // connection and ShedOldest closes the one that has waited longest.
+  ThreadPool::Overflow overflow = ThreadPool::Overflow::Block;
+};
+
+// Serves one client per call, from the threads of the worker pool. Stateless apart from the shared pool of
+// payload buffers, so a single instance serves all the connections.
 class Service {
 public:
-  Service() = default;
+  explicit Service(PayloadPool& payload_pool) : m_payload_pool(payload_pool) {}
 
-  void StartHandlingClient(std::shared_ptr<asio::ip::tcp::socket> sock) {
-    std::thread th{[this, sock]() { HandleClient(sock); }};
-    th.detach();
-  }
-
-private:
   void HandleClient(std::shared_ptr<asio::ip::tcp::socket> sock) {
     try {
-      asio::streambuf request;
-      asio::read_until(*sock.get(), request, '\n');
-
-      // Emulate request processing.
-      int i = 0;
-      while (i != 1000000) i++;
-      std::this_thread::sleep_for(std::chrono::milliseconds(500));
-
-      // Sending response.
-      std::string response = "Response\n";
-      asio::write(*sock.get(), asio::buffer(response));
+      // Clients speaking the binary protocol are recognized by the first byte of their request.
+      if (DetectProtocol(*sock.get()) == WireProtocol::Binary) {
+        HandleBinaryRequest(*sock.get());
+      } else {
+        HandleTextRequest(*sock.get());
+      }
     } catch (asio::system_error& e) {
       logging::get()->error("Error occurred! Error code = {}. Message: {}", e.code().value(), e.what());
     }
+  }
+
+private:
+  void HandleTextRequest(asio::ip::tcp::socket& sock) {
+    // The request is received into an arena of this thread, which goes back to the thread's cache with it.
+    PooledArena arena = ArenaCache::Acquire();
+    asio::basic_streambuf<ArenaAllocator<char>> request{std::numeric_limits<std::size_t>::max(),
+                                                        ArenaAllocator<char>{*arena}};
+    asio::read_until(sock, request, '\n');
+
+    ProcessRequest();
+
+    // Sending response.
+    std::string response = "Response\n";
+    asio::write(sock, asio::buffer(response));
+  }
 
-    // Clean up
-    delete this;
+  void HandleBinaryRequest(asio::ip::tcp::socket& sock) {
+    BinaryFrameReader request{m_payload_pool, BINARY_FRAME_MAX_REQUEST_PAYLOAD};
+    request.Read(sock);
+
+    ProcessRequest();
+
+    // Sending response, it carries the id of the request it answers.
+    std::string response = "Response";
+    unsigned char header[BINARY_FRAME_HEADER_SIZE];
+    MessageBuilder msg;
+    AppendBinaryFrame(msg, header, FrameType::Response, request.Header().request_id, response.data(),
+                      response.size());
+    asio::write(sock, msg.Buffers());
+  }
+
+  // Emulate request processing.
+  static void ProcessRequest() {
+    int i = 0;
+    while (i != 1000000) i++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
   }
+
+private:
+  PayloadPool& m_payload_pool;  // Shared by the threads serving the clients.
 };
 
 class Acceptor {
 public:
-  Acceptor(asio::io_service& ios, unsigned short port_num)
-      : m_ios{ios}, m_acceptor{m_ios, asio::ip::tcp::endpoint{asio::ip::address_v4::any(), port_num}} {
+  Acceptor(asio::io_service& ios, unsigned short port_num, Service& service, ThreadPool& workers,
+           ThreadPool::Overflow overflow)
+      : m_ios{ios},
+        m_acceptor{m_ios, asio::ip::tcp::endpoint{asio::ip::address_v4::any(), port_num}},
+        m_service(service),
+        m_workers(workers),
+        m_overflow{overflow} {
     m_acceptor.listen();
   }
 
@@ -48,17 +102,31 @@ public:
 
     m_acceptor.accept(*sock.get());
 
-    (new Service)->StartHandlingClient(sock);
+    // Hand the connection to the worker pool. A connection that is rejected or shed from the queue is closed
+    // when the last reference to its socket goes away.
+    Service& service = m_service;
+    m_workers.Post([&service, sock]() { service.HandleClient(sock); }, m_overflow);
   }
 
 private:
   asio::io_service& m_ios;
   asio::ip::tcp::acceptor m_acceptor;
+  Service& m_service;
+  ThreadPool& m_workers;
+  ThreadPool::Overflow m_overflow;
 };
 
+// Maximum number of request payload buffers kept for reuse.
+const std::size_t MAX_FREE_PAYLOAD_BUFFERS = 64;
+
 class Server {
 public:
-  Server() : m_stop{false} {}
+  explicit Server(const ServerConfig& config = ServerConfig{})
+      : m_config(config),
+        m_stop{false},
+        m_payload_pool{PayloadBufferFactory(), MAX_FREE_PAYLOAD_BUFFERS},
+        m_service{m_payload_pool},
+        m_workers{config.num_workers, config.queue_capacity} {}
 
   void Start(unsigned short port_num) {
     m_thread.reset(new std::thread([this, port_num]() { Run(port_num); }));
@@ -67,11 +135,16 @@ public:
   void Stop() {
     m_stop.store(true);
     m_thread->join();
+
+    // Close the connections still queued and wait for the clients being served.
+    m_workers.Stop();
   }
 
+  ThreadPool::Stats GetStats() const { return m_workers.GetStats(); }
+
 private:
   void Run(unsigned short port_num) {
-    Acceptor acc{m_ios, port_num};
+    Acceptor acc{m_ios, port_num, m_service, m_workers, m_config.overflow};
 
     while (!m_stop.load()) {
       acc.Accept();
@@ -79,21 +152,40 @@ private:
   }
 
 private:
+  ServerConfig m_config;
   std::unique_ptr<std::thread> m_thread;
   std::atomic<bool> m_stop;
   asio::io_service m_ios;
+  PayloadPool m_payload_pool;  // Outlives the workers, which use it until they are stopped.
+  Service m_service;
+  ThreadPool m_workers;  // Serve the accepted connections.
 };
 
-int main() {
+// Usage: 02_SyncParallelTCPServer [block|reject|shed-oldest]
+int main(int argc, char* argv[]) {
   auto console = logging::setup();
 
   unsigned short port_num = 3333;
 
+  ServerConfig config;
+  if (argc > 1 && std::strcmp(argv[1], "reject") == 0) {
+    config.overflow = ThreadPool::Overflow::Reject;
+  } else if (argc > 1 && std::strcmp(argv[1], "shed-oldest") == 0) {
+    config.overflow = ThreadPool::Overflow::ShedOldest;
+  }
+
   try {
-    Server srv;
+    Server srv{config};
     srv.Start(port_num);
 
-    std::this_thread::sleep_for(std::chrono::seconds(60));
+    // Report the depth of the connection queue every few seconds.
+    for (int i = 0; i < 12; ++i) {
+      std::this_thread::sleep_for(std::chrono::seconds(5));
+
+      ThreadPool::Stats stats = srv.GetStats();
+      console->info("Connection queue: {} waiting (peak {}), {} accepts blocked, {} rejected, {} shed.",
+                    stats.queued, stats.max_queued, stats.blocked, stats.rejected, stats.shed);
+    }
 
     srv.Stop();
   } catch (asio::system_error& e) {
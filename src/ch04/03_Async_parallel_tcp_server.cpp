@@ -1,78 +1,550 @@
+#include "../common/arena.h"
+#include "../common/binary_frame.h"
+#include "../common/frame_reader.h"
+#include "../common/io_service_pool.h"
 #include "../common/logging.h"
+#include "../common/message_builder.h"
+#include "../common/thread_pool.h"
+#include "../common/timer_wheel.h"
 #include <asio.hpp>
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <memory>
 #include <thread>
+#include <vector>
+
+// Settings shared by all the connections served by the server.
+struct ServiceConfig {
+  // A connection that does not send a new request within this time is closed.
+  std::chrono::steady_clock::duration idle_timeout = std::chrono::seconds(30);
+
+  // A request must be received completely within this time of its first bytes, and a write of responses
+  // must complete within this time, otherwise the connection is closed (e.g. a client sending or reading
+  // byte by byte).
+  std::chrono::steady_clock::duration read_timeout = std::chrono::seconds(10);
+  std::chrono::steady_clock::duration write_timeout = std::chrono::seconds(10);
+
+  // Number of requests served on a connection before it is closed, 0 means unlimited.
+  unsigned int max_requests_per_connection = 100;
+
+  // Maximum number of requests of a connection processed concurrently, the server stops reading from the
+  // connection while that many responses are pending.
+  std::size_t max_pipelined_requests = 32;
+
+  // Requests are processed by a separate pool of workers so that slow requests never block the threads
+  // running the event loops. When its queue is full new requests are answered with an error right away.
+  unsigned int compute_pool_size = 16;
+  std::size_t compute_queue_capacity = 1024;
+
+  // Maximum number of request payload buffers kept for reuse by binary protocol connections, and longest
+  // binary request payload accepted: a connection announcing a longer one is closed.
+  std::size_t max_free_payload_buffers = 1024;
+  std::uint32_t max_request_payload = BINARY_FRAME_MAX_REQUEST_PAYLOAD;
+
+  // The processing of a request is emulated with a CPU-bound loop and a sleep. The benchmarks (src/bench)
+  // turn it off to measure the server itself.
+  bool emulate_processing = true;
+};
 
-class Service {
+// Serves one persistent (keep-alive) connection carrying either newline-delimited text requests or length-
+// prefixed binary frames (see binary_frame.h), told apart by the first byte the client sends. Requests are
+// pipelined: every complete request received is dispatched to the compute pool right away, without waiting
+// for the responses to the previous ones. Text responses are written back in request order, binary ones carry
+// the id of the request they answer and are written as soon as they are ready. The connection ends when the
+// client closes it, it stays idle for too long or the request cap is hit.
+// When several threads run the connection's io_service, all the handlers are executed through the
+// connection's strand, so the timeouts and the compute pool completions never race with the I/O handlers.
+// When a single thread runs it (the per-core modes), the connection is bound to that thread for its lifetime:
+// its handlers are already serialized, so they are executed without a strand and the state of the connection
+// stays in the cache of the CPU serving it. The timeouts are tracked in the timer wheel of the connection's
+// shard. The object is kept alive by the handlers and the timer that reference it.
+class Service : public std::enable_shared_from_this<Service> {
 public:
-  Service(std::shared_ptr<asio::ip::tcp::socket> sock) : m_sock{sock} {}
+  Service(std::shared_ptr<asio::ip::tcp::socket> sock, IoServicePool& pool, std::size_t shard,
+          const ServiceConfig& config, ThreadPool& compute_pool, PayloadPool& payload_pool,
+          TimerWheel& timers)
+      : m_sock{sock},
+        m_protocol{WireProtocol::Text},
+        m_binary_request{payload_pool, config.max_request_payload},
+        m_pool(pool),
+        m_shard{shard},
+        m_config(config),
+        m_compute_pool(compute_pool),
+        m_ios(pool.GetIoService(shard)),
+        m_strand{pool.SingleThreadedShards() ? nullptr : new asio::io_service::strand{m_ios}},
+        m_timers(timers),
+        m_timeout{[this]() {
+          auto self = shared_from_this();
+          Post([self]() { self->onTimeout(); });
+        }},
+        m_num_requests{0},
+        m_deadline{std::chrono::steady_clock::time_point::max()},
+        m_first_seq{0},
+        m_num_writing{0},
+        m_reading{false},
+        m_partial_request{false},
+        m_read_closed{false},
+        m_finished{false} {}
+  ~Service() { m_pool.Release(m_shard); }
 
   void StartHandling() {
-    asio::async_read_until(*m_sock.get(), m_request, '\n',
-                           [this](const asio::error_code& ec, std::size_t bytes_transferred) {
-                             onRequestReceived(ec, bytes_transferred);
-                           });
+    m_reading = true;
+    UpdateTimeout();
+
+    // Wait for the first bytes without consuming them, they tell which protocol the client speaks.
+    auto self = shared_from_this();
+    Initiate([this](auto handler) { m_sock->async_read_some(asio::null_buffers(), std::move(handler)); },
+             [self](const asio::error_code& ec, std::size_t /* bytes */) { self->onFirstBytes(ec); });
   }
 
 private:
-  void onRequestReceived(const asio::error_code& ec, std::size_t /* bytes_transferred */) {
-    if (ec.value() != 0) {
+  // Slot of the response queue, filled in when the compute pool is done with the request. The strings of the
+  // request live in its arena, which goes back to the cache of the thread when the slot is released.
+  struct PendingResponse {
+    PooledArena m_arena;
+    ArenaString m_response;
+    std::uint64_t m_request_id = 0;  // Echoed back in binary responses.
+    FrameType m_type = FrameType::Response;
+    unsigned char m_header[BINARY_FRAME_HEADER_SIZE];  // Encoded binary header, referenced by the write.
+    bool m_ready = false;
+    bool m_writing = false;  // Covered by the pending write.
+    bool m_sent = false;
+  };
+
+  void onFirstBytes(const asio::error_code& ec) {
+    // Closed by the idle timeout before sending anything.
+    if (ec == asio::error::operation_aborted) {
+      onReadCompleted(ec);
+      return;
+    }
+
+    if (!ec) {
+      unsigned char first = 0;
+      asio::error_code peek_ec;
+      m_sock->receive(asio::buffer(&first, 1), asio::socket_base::message_peek, peek_ec);
+      if (!peek_ec && first == BINARY_FRAME_MAGIC) m_protocol = WireProtocol::Binary;
+    }
+
+    // Lets onReadable() receive without blocking the thread.
+    asio::error_code ignored_ec;
+    m_sock->non_blocking(true, ignored_ec);
+
+    // Errors, including the end of the stream, are reported by the first real read.
+    ReadRequests();
+  }
+
+  void ReadRequests() {
+    m_reading = true;
+    UpdateTimeout();
+
+    auto self = shared_from_this();
+    if (m_protocol == WireProtocol::Binary) {
+      // One frame per read: an exact-size read of the header, then one of the payload.
+      Initiate([this](auto handler) { m_binary_request.AsyncRead(*m_sock, std::move(handler)); },
+               [self](const asio::error_code& ec) { self->onBinaryRequestReceived(ec); });
+      return;
+    }
+
+    if (m_request.Pending() == 0) {
+      // Nothing is buffered: wait for the next request without holding a receive buffer, so that idle
+      // connections keep no buffer memory.
+      m_request.Release();
+      Initiate([this](auto handler) { m_sock->async_read_some(asio::null_buffers(), std::move(handler)); },
+               [self](const asio::error_code& ec, std::size_t /* bytes */) { self->onReadable(ec); });
+      return;
+    }
+
+    // Receive straight into the frame reader, the requests are split out of it without copying.
+    Initiate([this](auto handler) { m_sock->async_read_some(m_request.Prepare(), std::move(handler)); },
+             [self](const asio::error_code& ec, std::size_t bytes_transferred) {
+               self->onRequestReceived(ec, bytes_transferred);
+             });
+  }
+
+  // Starts an asynchronous operation, `initiate` being called with the completion handler to pass to it. The
+  // handler goes through the strand if the connection has one.
+  template <typename Initiation, typename Handler>
+  void Initiate(Initiation initiate, Handler handler) {
+    if (m_strand) {
+      initiate(m_strand->wrap(std::move(handler)));
+    } else {
+      initiate(std::move(handler));
+    }
+  }
+
+  // Executes the handler in the context of the connection: through its strand, or on the thread of its
+  // io_service.
+  template <typename Handler>
+  void Post(Handler handler) {
+    if (m_strand) {
+      m_strand->post(std::move(handler));
+    } else {
+      m_ios.post(std::move(handler));
+    }
+  }
+
+  // Arms the timeout of what the connection is waiting for:
+  // - a write in progress must complete within the write timeout;
+  // - a request whose first bytes have arrived must be complete within the read timeout;
+  // - with nothing else in progress, the next request must arrive within the idle timeout.
+  // Nothing is armed while requests are being processed.
+  void UpdateTimeout() {
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    if (m_num_writing != 0) {
+      deadline = m_write_started + m_config.write_timeout;
+    } else if (m_reading && m_responses.empty()) {
+      deadline = m_partial_request ? m_read_started + m_config.read_timeout
+                                   : std::chrono::steady_clock::now() + m_config.idle_timeout;
+    }
+
+    if (deadline == m_deadline) return;
+    m_deadline = deadline;
+
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+      m_timers.Cancel(m_timeout);
+    } else {
+      m_timers.Arm(m_timeout, deadline, shared_from_this());
+    }
+  }
+
+  void onTimeout() {
+    // The timeout has been cancelled or moved since the timer expired.
+    if (m_finished || std::chrono::steady_clock::now() < m_deadline) return;
+
+    logging::get()->debug("Closing the connection, {} timeout.",
+                          m_num_writing != 0 ? "write" : m_partial_request ? "read" : "idle");
+
+    // Closing the socket aborts the pending read, whose handler finishes the connection.
+    asio::error_code ignored_ec;
+    m_sock->close(ignored_ec);
+  }
+
+  // The socket of an idle text connection has data: receive it right away into a buffer taken from the
+  // cache of this thread.
+  void onReadable(const asio::error_code& ec) {
+    if (ec) {
+      onRequestReceived(ec, 0);
+      return;
+    }
+
+    asio::error_code read_ec;
+    std::size_t bytes_transferred = m_sock->read_some(m_request.Prepare(), read_ec);
+    if (read_ec == asio::error::would_block) {
+      // Spurious wake-up, wait again.
+      ReadRequests();
+      return;
+    }
+
+    onRequestReceived(read_ec, bytes_transferred);
+  }
+
+  void onRequestReceived(const asio::error_code& ec, std::size_t bytes_transferred) {
+    if (!onReadCompleted(ec)) return;
+
+    m_request.Commit(bytes_transferred);
+    ContinueReading();
+  }
+
+  void onBinaryRequestReceived(const asio::error_code& ec) {
+    if (!onReadCompleted(ec)) return;
+
+    const BinaryFrameHeader& header = m_binary_request.Header();
+    if (header.type != FrameType::Request) {
+      logging::get()->error("Unexpected frame type {}, closing the connection.",
+                            static_cast<int>(header.type));
+      onFinish();
+      return;
+    }
+
+    DispatchRequest(m_binary_request.Payload(), header.request_id);
+    m_binary_request.Release();
+    ContinueReading();
+  }
+
+  // Common handling of a completed read. Returns false if the read failed and there is nothing to frame.
+  bool onReadCompleted(const asio::error_code& ec) {
+    m_reading = false;
+    UpdateTimeout();
+
+    if (ec.value() == 0) return true;
+
+    if (ec == asio::error::eof) {
+      // The client is done sending. Responses still in flight are written before the connection ends.
+      m_read_closed = true;
+      if (m_responses.empty()) onFinish();
+      return false;
+    }
+
+    if (ec != asio::error::operation_aborted) {
       logging::get()->error("Error occurred! Error code = {}. Message: {}", ec.value(), ec.message());
+    }
+    onFinish();
+    return false;
+  }
+
+  // Dispatch the complete requests sitting in the receive buffer (a read may bring several pipelined ones),
+  // then read more if the pipeline has room left.
+  void ContinueReading() {
+    FrameView request;
+    while (m_protocol == WireProtocol::Text && CanAcceptRequest() && m_request.Next(request)) {
+      DispatchRequest(request, 0);
+    }
+
+    // The read timeout of a request runs from its first bytes, not from the last read.
+    if (m_protocol == WireProtocol::Text && m_request.Pending() != 0) {
+      if (!m_partial_request) m_read_started = std::chrono::steady_clock::now();
+      m_partial_request = true;
+    } else {
+      m_partial_request = false;
+    }
+
+    if (!CanAcceptRequest()) return;
+
+    if (m_request.Full()) {
+      logging::get()->error("Request exceeds the maximum size, closing the connection.");
       onFinish();
       return;
     }
 
-    // Process the request.
-    m_response = ProcessRequest(m_request);
+    ReadRequests();
+  }
+
+  bool CanAcceptRequest() const {
+    return !m_finished && !m_read_closed && !RequestCapReached() &&
+           m_responses.size() < m_config.max_pipelined_requests;
+  }
+
+  bool RequestCapReached() const {
+    return m_config.max_requests_per_connection != 0 &&
+           m_num_requests >= m_config.max_requests_per_connection;
+  }
 
-    // Initiate asynchronous write operation.
-    asio::async_write(*m_sock.get(), asio::buffer(m_response),
-                      [this](const asio::error_code& write_ec, std::size_t write_bytes_transferred) {
-                        onResponseSent(write_ec, write_bytes_transferred);
-                      });
+  // Copy the request out of the receive buffer into the arena of the request and hand it over to the compute
+  // pool. Its response gets the next slot of the response queue. The arena is only used by one thread at a
+  // time: this one until the task is queued, then the compute pool until its result is posted back.
+  void DispatchRequest(const FrameView& frame, std::uint64_t request_id) {
+    ++m_num_requests;
+
+    std::uint64_t seq = m_first_seq + m_responses.size();
+    m_responses.emplace_back();
+    PendingResponse& slot = m_responses.back();
+    slot.m_request_id = request_id;
+    slot.m_arena = ArenaCache::Acquire();
+
+    Arena* arena = slot.m_arena.get();
+    ArenaString request{frame.data, frame.size, ArenaAllocator<char>{*arena}};
+
+    auto self = shared_from_this();
+    bool queued = m_compute_pool.Post([self, seq, arena, request = std::move(request)]() mutable {
+      // The request is moved out of the task so that it is gone before the arena is handed back to the
+      // connection, the task itself is only destroyed after the response has been posted.
+      ArenaString response = self->ProcessRequest(ArenaString{std::move(request)}, *arena);
+      self->Post([self, seq, response = std::move(response)]() mutable {
+        self->onRequestProcessed(seq, std::move(response));
+      });
+    });
+
+    if (!queued) {
+      logging::get()->warn("Compute pool is saturated, rejecting the request.");
+      onRequestProcessed(seq, ArenaString{"ERROR", ArenaAllocator<char>{*arena}}, FrameType::Error);
+    }
+  }
+
+  void onRequestProcessed(std::uint64_t seq, ArenaString response, FrameType type = FrameType::Response) {
+    if (m_finished) return;
+
+    PendingResponse& slot = m_responses[static_cast<std::size_t>(seq - m_first_seq)];
+    slot.m_response = std::move(response);
+    slot.m_type = type;
+    slot.m_ready = true;
+
+    WriteResponses();
+  }
+
+  // Write all the ready responses at the head of the queue with a single gather operation. Responses that
+  // completed out of order wait until the ones before them are ready.
+  void WriteResponses() {
+    if (m_num_writing != 0 || m_finished) return;
+
+    // Binary responses carry the id of their request, so they are written as soon as they are ready and a
+    // slow request does not hold back the ones after it. Text responses are written in request order.
+    m_write_msg.Clear();
+    for (auto& slot : m_responses) {
+      if (slot.m_sent) continue;
+      if (m_write_msg.Available() < 2) break;  // Full, the rest goes with the next write.
+      if (!slot.m_ready) {
+        if (m_protocol == WireProtocol::Binary) continue;
+        break;
+      }
+
+      if (m_protocol == WireProtocol::Binary) {
+        AppendBinaryFrame(m_write_msg, slot.m_header, slot.m_type, slot.m_request_id, slot.m_response.data(),
+                          slot.m_response.size());
+      } else {
+        m_write_msg.Append(slot.m_response.data(), slot.m_response.size()).Append("\n");
+      }
+      slot.m_writing = true;
+      ++m_num_writing;
+    }
+
+    if (m_num_writing == 0) return;
+
+    m_write_started = std::chrono::steady_clock::now();
+    UpdateTimeout();
+
+    auto self = shared_from_this();
+    Initiate([this](auto handler) { asio::async_write(*m_sock, m_write_msg.Buffers(), std::move(handler)); },
+             [self](const asio::error_code& write_ec, std::size_t bytes_sent) {
+               self->onResponseSent(write_ec, bytes_sent);
+             });
   }
 
   void onResponseSent(const asio::error_code& ec, std::size_t /* bytes_transferred */) {
     if (ec.value() != 0) {
       logging::get()->error("Error occurred! Error code = {}. Message: {}", ec.value(), ec.message());
+      onFinish();
+      return;
     }
 
-    onFinish();
+    for (auto& slot : m_responses) {
+      if (!slot.m_writing) continue;
+      slot.m_writing = false;
+      slot.m_sent = true;
+    }
+    m_num_writing = 0;
+
+    // Slots are released in order, the ones sent ahead of an earlier response wait for it.
+    while (!m_responses.empty() && m_responses.front().m_sent) {
+      m_responses.pop_front();
+      ++m_first_seq;
+    }
+
+    if (m_responses.empty() && (m_read_closed || RequestCapReached())) {
+      onFinish();
+      return;
+    }
+
+    WriteResponses();
+
+    if (!m_reading) ContinueReading();
+
+    // Everything may have been answered, the connection is then idle until the pending read completes.
+    UpdateTimeout();
   }
 
-  // Here we perform the cleanup.
-  void onFinish() { delete this; }
+  // Here we perform the cleanup. The object itself is freed once the last handler referencing it is done.
+  void onFinish() {
+    m_finished = true;
+    m_deadline = std::chrono::steady_clock::time_point::max();
+    m_timers.Cancel(m_timeout);
 
-  std::string ProcessRequest(asio::streambuf& /* request */) {
-    // In this method we parse the request, process it and prepare the response.
+    asio::error_code ignored_ec;
+    m_sock->shutdown(asio::ip::tcp::socket::shutdown_both, ignored_ec);
+    m_sock->close(ignored_ec);
+  }
 
-    // emulate CPU-consuming operations.
-    int i = 0;
-    while (i != 1000000) i++;
+  // Executed by the compute pool, must not touch the state owned by the strand. Transient data, the response
+  // included, is allocated in the arena of the request.
+  ArenaString ProcessRequest(const ArenaString& /* request */, Arena& arena) const {
+    // In this method we parse the request, process it and prepare the response.
+    if (m_config.emulate_processing) {
+      // emulate CPU-consuming operations.
+      int i = 0;
+      while (i != 1000000) i++;
 
-    // Emulate operations that block the thread (e.g. sync I/O operations).
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+      // Emulate operations that block the thread (e.g. sync I/O operations).
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
 
-    // Prepare and return the response message.
-    std::string response = "Response\n";
+    // Prepare and return the response message. The framing is added when it is written.
+    ArenaString response{"Response", ArenaAllocator<char>{arena}};
     return response;
   }
 
 private:
   std::shared_ptr<asio::ip::tcp::socket> m_sock;
-  std::string m_response;
-  asio::streambuf m_request;
+  WireProtocol m_protocol;              // Detected from the first byte received.
+  FrameReader m_request;                // Receive buffer the text requests are framed in.
+  BinaryFrameReader m_binary_request;   // Reads binary requests into pooled payload buffers.
+
+  IoServicePool& m_pool;  // Pool the socket's io_service belongs to.
+  std::size_t m_shard;    // Shard of the pool serving this connection.
+  const ServiceConfig& m_config;
+  ThreadPool& m_compute_pool;  // Workers processing the requests.
+
+  asio::io_service& m_ios;  // Event loop the connection is bound to.
+
+  // Serializes the I/O, timer and compute pool handlers when several threads run m_ios, null otherwise.
+  std::unique_ptr<asio::io_service::strand> m_strand;
+  TimerWheel& m_timers;         // Timer wheel of the connection's shard.
+  TimerWheel::Timer m_timeout;  // Closes the connection when the current deadline passes.
+  unsigned int m_num_requests;  // Number of requests received on this connection so far.
+
+  std::chrono::steady_clock::time_point m_deadline;       // Deadline m_timeout is armed for.
+  std::chrono::steady_clock::time_point m_read_started;   // First bytes of the partial request arrived.
+  std::chrono::steady_clock::time_point m_write_started;  // The pending write started.
+
+  std::deque<PendingResponse> m_responses;       // Responses in request order, the head is written first.
+  std::uint64_t m_first_seq;                     // Sequence number of the head of m_responses.
+  std::size_t m_num_writing;                     // Number of responses the pending write covers.
+  MessageBuilder m_write_msg;                    // Responses covered by the pending write.
+
+  bool m_reading;          // A read operation is in progress.
+  bool m_partial_request;  // The receive buffer holds the beginning of a request.
+  bool m_read_closed;      // The client has closed its sending side.
+  bool m_finished;         // The connection has been closed.
 };
 
+#ifdef SO_REUSEPORT
+// Socket option allowing several sockets to listen on the same port, the kernel spreads the incoming
+// connections among them.
+typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+// Timer wheels tracking the timeouts of the connections, one per shard of the pool.
+typedef std::vector<std::unique_ptr<TimerWheel>> TimerWheels;
+
 class Acceptor {
 public:
-  Acceptor(asio::io_service& ios, unsigned short port_num)
-      : m_ios{ios},
-        m_acceptor{m_ios, asio::ip::tcp::endpoint(asio::ip::address_v4::any(), port_num)},
+  // The acceptor itself runs on the first shard of the pool, accepted sockets are handed over to the shard
+  // chosen by the pool's dispatch policy.
+  Acceptor(IoServicePool& pool, unsigned short port_num, const ServiceConfig& config,
+           ThreadPool& compute_pool, PayloadPool& payload_pool, TimerWheels& timer_wheels)
+      : m_pool(pool),
+        m_config(config),
+        m_compute_pool(compute_pool),
+        m_payload_pool(payload_pool),
+        m_timer_wheels(timer_wheels),
+        m_acceptor{m_pool.GetIoService(0), asio::ip::tcp::endpoint(asio::ip::address_v4::any(), port_num)},
+        m_shard{-1},
         m_isStopped{false} {}
 
+  // The acceptor runs on the given shard and keeps the accepted sockets there. Several such acceptors, one
+  // per shard, listen on the same port with SO_REUSEPORT so no cross-thread handoff is needed.
+  Acceptor(IoServicePool& pool, std::size_t shard, unsigned short port_num, const ServiceConfig& config,
+           ThreadPool& compute_pool, PayloadPool& payload_pool, TimerWheels& timer_wheels)
+      : m_pool(pool),
+        m_config(config),
+        m_compute_pool(compute_pool),
+        m_payload_pool(payload_pool),
+        m_timer_wheels(timer_wheels),
+        m_acceptor{m_pool.GetIoService(shard)},
+        m_shard{static_cast<int>(shard)},
+        m_isStopped{false} {
+    asio::ip::tcp::endpoint ep{asio::ip::address_v4::any(), port_num};
+
+    m_acceptor.open(ep.protocol());
+    m_acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+    m_acceptor.set_option(reuse_port(true));
+#endif
+    m_acceptor.bind(ep);
+  }
+
   // Start accepting incoming connection requests.
   void Start() {
     m_acceptor.listen();
@@ -84,15 +556,22 @@ public:
 
 private:
   void InitAccept() {
-    auto sock = std::make_shared<asio::ip::tcp::socket>(m_ios);
+    // The socket is created on the io_service of the shard that is going to serve the connection, so all its
+    // completion handlers are executed by the threads of that shard.
+    std::size_t shard = m_shard < 0 ? m_pool.Acquire() : m_pool.Acquire(static_cast<std::size_t>(m_shard));
+    auto sock = std::make_shared<asio::ip::tcp::socket>(m_pool.GetIoService(shard));
 
-    m_acceptor.async_accept(*sock.get(), [this, sock](const asio::error_code& ec) { onAccept(ec, sock); });
+    m_acceptor.async_accept(*sock.get(),
+                            [this, sock, shard](const asio::error_code& ec) { onAccept(ec, sock, shard); });
   }
 
-  void onAccept(const asio::error_code& ec, std::shared_ptr<asio::ip::tcp::socket> sock) {
+  void onAccept(const asio::error_code& ec, std::shared_ptr<asio::ip::tcp::socket> sock, std::size_t shard) {
     if (ec.value() == 0) {
-      (new Service(sock))->StartHandling();
+      std::make_shared<Service>(sock, m_pool, shard, m_config, m_compute_pool, m_payload_pool,
+                                *m_timer_wheels[shard])
+          ->StartHandling();
     } else {
+      m_pool.Release(shard);
       logging::get()->error("Error occured! Error code = {}. Message: {}", ec.value(), ec.message());
     }
 
@@ -106,58 +585,123 @@ private:
   }
 
 private:
-  asio::io_service& m_ios;
+  IoServicePool& m_pool;
+  const ServiceConfig& m_config;
+  ThreadPool& m_compute_pool;
+  PayloadPool& m_payload_pool;
+  TimerWheels& m_timer_wheels;
   asio::ip::tcp::acceptor m_acceptor;
+  int m_shard;  // Shard the accepted sockets are pinned to, or -1 to use the pool's dispatch policy.
   std::atomic<bool> m_isStopped;
 };
 
+// Defines how the server distributes the connections across its threads.
+enum class ServerMode {
+  SharedIoService,   // All the threads of the pool run one shared io_service.
+  IoServicePerCore,  // Every thread runs its own io_service and is pinned to its own CPU.
+  ReusePortPerCore,  // Like IoServicePerCore, but every thread also has its own SO_REUSEPORT acceptor.
+};
+
 class Server {
 public:
-  Server() { m_work.reset(new asio::io_service::work(m_ios)); }
+  Server(ServerMode mode = ServerMode::SharedIoService,
+         IoServicePool::Dispatch dispatch = IoServicePool::Dispatch::RoundRobin,
+         const ServiceConfig& config = ServiceConfig{})
+      : m_mode{mode},
+        m_dispatch{dispatch},
+        m_config(config),
+        m_payload_pool{PayloadBufferFactory(), config.max_free_payload_buffers} {}
 
   // Start the server.
   void Start(unsigned short port_num, unsigned int thread_pool_size) {
     assert(thread_pool_size > 0);
 
-    // create and start Acceptor.
-    acc.reset(new Acceptor(m_ios, port_num));
-    acc->Start();
+    m_compute_pool.reset(new ThreadPool(m_config.compute_pool_size, m_config.compute_queue_capacity));
+
+    if (m_mode == ServerMode::SharedIoService) {
+      m_pool.reset(new IoServicePool(1, thread_pool_size, false, m_dispatch));
+    } else {
+      m_pool.reset(new IoServicePool(thread_pool_size, 1, true, m_dispatch));
+    }
+
+    for (std::size_t shard = 0; shard < m_pool->Size(); ++shard) {
+      m_timer_wheels.emplace_back(new TimerWheel(m_pool->GetIoService(shard), TIMER_TICK));
+    }
 
-    // Create specified number of threads and add them to the pool.
-    for (unsigned int i = 0; i < thread_pool_size; ++i) {
-      std::unique_ptr<std::thread> th(new std::thread([this]() { m_ios.run(); }));
-      m_thread_pool.push_back(std::move(th));
+    // create and start Acceptors.
+    if (m_mode == ServerMode::ReusePortPerCore) {
+      for (std::size_t shard = 0; shard < m_pool->Size(); ++shard) {
+        m_acceptors.emplace_back(
+            new Acceptor(*m_pool, shard, port_num, m_config, *m_compute_pool, m_payload_pool,
+                         m_timer_wheels));
+      }
+    } else {
+      m_acceptors.emplace_back(
+          new Acceptor(*m_pool, port_num, m_config, *m_compute_pool, m_payload_pool, m_timer_wheels));
     }
+
+    for (auto& acc : m_acceptors) {
+      acc->Start();
+    }
+
+    // Start the threads running the event loops.
+    m_pool->Start();
   }
 
   // Stop the server.
   void Stop() {
-    acc->Stop();
-    m_ios.stop();
-
-    for (auto& th : m_thread_pool) {
-      th->join();
+    for (auto& acc : m_acceptors) {
+      acc->Stop();
     }
+    m_compute_pool->Stop();
+    m_pool->Stop();
   }
 
 private:
-  asio::io_service m_ios;
-  std::unique_ptr<asio::io_service::work> m_work;
-  std::unique_ptr<Acceptor> acc;
-  std::vector<std::unique_ptr<std::thread>> m_thread_pool;
+  // Resolution of the connection timeouts.
+  static constexpr std::chrono::milliseconds TIMER_TICK{100};
+
+  ServerMode m_mode;
+  IoServicePool::Dispatch m_dispatch;
+  ServiceConfig m_config;
+  PayloadPool m_payload_pool;  // Declared before m_pool, the connections give their buffers back to it.
+  std::unique_ptr<IoServicePool> m_pool;
+
+  // Destroyed before m_pool: their asio timers must not outlive the io_services. A tick wait still queued in
+  // an io_service keeps its own memory alive until the io_service is done with it.
+  TimerWheels m_timer_wheels;
+  std::unique_ptr<ThreadPool> m_compute_pool;  // Destroyed before m_pool, its tasks post to the strands.
+  std::vector<std::unique_ptr<Acceptor>> m_acceptors;
 };
 
+constexpr std::chrono::milliseconds Server::TIMER_TICK;
+
 const unsigned int DEFAULT_THREAD_POOL_SIZE = 2;
 
-int main() {
+// The benchmarks (src/bench) include the server without its main().
+#ifndef RECIPE_NO_MAIN
+// Usage: 03_AsyncParallelTCPServer [shared|per-core|per-core-least-loaded|reuseport]
+int main(int argc, char* argv[]) {
   auto console = logging::setup();
 
   unsigned short port_num = 3333;
 
+  ServerMode mode = ServerMode::SharedIoService;
+  IoServicePool::Dispatch dispatch = IoServicePool::Dispatch::RoundRobin;
+  if (argc > 1 && std::strcmp(argv[1], "per-core") == 0) {
+    mode = ServerMode::IoServicePerCore;
+  } else if (argc > 1 && std::strcmp(argv[1], "per-core-least-loaded") == 0) {
+    mode = ServerMode::IoServicePerCore;
+    dispatch = IoServicePool::Dispatch::LeastLoaded;
+  } else if (argc > 1 && std::strcmp(argv[1], "reuseport") == 0) {
+    mode = ServerMode::ReusePortPerCore;
+  }
+
   try {
-    Server srv;
+    Server srv{mode, dispatch};
 
-    unsigned int thread_pool_size = std::thread::hardware_concurrency() * 2;
+    // The I/O threads never block, so one event loop per CPU is enough in every mode.
+    unsigned int thread_pool_size = std::thread::hardware_concurrency();
     if (thread_pool_size == 0) thread_pool_size = DEFAULT_THREAD_POOL_SIZE;
 
     srv.Start(port_num, thread_pool_size);
@@ -172,3 +716,4 @@ int main() {
 
   return 0;
 }
+#endif /* RECIPE_NO_MAIN */
@@ -0,0 +1,284 @@
+#include "../common/datagram_batch.h"
+#include "../common/handler_allocator.h"
+#include "../common/io_service_pool.h"
+#include "../common/logging.h"
+#include <algorithm>
+#include <asio.hpp>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef SO_REUSEPORT
+// Socket option allowing several sockets to bind the same port, the kernel spreads the incoming datagrams
+// among them by source address.
+typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+// Serves the requests arriving on one UDP socket. There are no connections: every datagram is a complete
+// `EMULATE_LONG_COMP_OP [s]` request and gets one datagram back, `OK` once the emulated operation is over or
+// `ERROR` if the request is malformed or the service is overloaded. The socket is non-blocking and the event
+// loop only reports that it is readable, the datagrams themselves are drained in batches with one system
+// call per batch (recvmmsg), and the replies of a batch go out together (sendmmsg).
+// All the memory is allocated up front: the receive and reply batches, the queue of deferred replies and
+// the memory of the asynchronous operations, so serving a request never allocates.
+class Service {
+public:
+  Service(asio::io_service& ios, unsigned short port_num, bool reuse)
+      : m_sock{ios},
+        m_timer{ios},
+        m_requests{BATCH_SIZE, MAX_DATAGRAM_SIZE},
+        m_replies{BATCH_SIZE, MAX_DATAGRAM_SIZE},
+        m_timer_armed{false},
+        m_wait_memory{std::make_shared<HandlerMemory>()},
+        m_timer_memory{std::make_shared<HandlerMemory>()},
+        m_isStopped{false} {
+    asio::ip::udp::endpoint ep{asio::ip::address_v4::any(), port_num};
+
+    m_sock.open(ep.protocol());
+#ifdef SO_REUSEPORT
+    if (reuse) m_sock.set_option(reuse_port(true));
+#else
+    (void)reuse;
+#endif
+    m_sock.bind(ep);
+    m_sock.non_blocking(true);
+
+    m_pending.reserve(MAX_PENDING_REPLIES);
+  }
+
+  void Start() { WaitForRequests(); }
+
+  // Stop serving. The socket is closed when the pending wait completes.
+  void Stop() { m_isStopped.store(true); }
+
+private:
+  // Reply to a request whose emulated operation is still running.
+  struct PendingReply {
+    std::chrono::steady_clock::time_point m_due;
+    asio::ip::udp::endpoint m_sender;
+
+    bool operator>(const PendingReply& rhs) const { return m_due > rhs.m_due; }
+  };
+
+  // The waits share the ownership of their memory: the service is destroyed before the io_service, and a
+  // wait cancelled then stays queued in the io_service until it is destroyed, asio releases its memory then.
+  void WaitForRequests() {
+    std::shared_ptr<HandlerMemory> memory = m_wait_memory;
+    auto on_readable = [this, memory](const asio::error_code& ec, std::size_t /* bytes */) {
+      onReadable(ec);
+    };
+    m_sock.async_receive(asio::null_buffers(), MakeCustomAllocHandler(*memory, on_readable));
+  }
+
+  void onReadable(const asio::error_code& ec) {
+    if (ec.value() != 0) {
+      if (ec != asio::error::operation_aborted) {
+        logging::get()->error("Error occurred! Error code = {}. Message: {}", ec.value(), ec.message());
+      }
+      return;
+    }
+
+    if (m_isStopped.load()) {
+      m_sock.close();
+      m_timer.cancel();
+      return;
+    }
+
+    // Drain the socket batch by batch. A batch that comes back partially filled means the socket is empty.
+    asio::error_code receive_ec;
+    do {
+      if (ReceiveDatagrams(m_sock, m_requests, receive_ec) == 0) break;
+
+      m_replies.Clear();
+      for (std::size_t i = 0; i < m_requests.Size(); ++i) {
+        ProcessRequest(m_requests.Data(i), m_requests.Size(i), m_requests.Endpoint(i));
+      }
+      SendReplies();
+    } while (m_requests.Full());
+
+    if (receive_ec && receive_ec != asio::error::would_block) {
+      logging::get()->error("Error occurred! Error code = {}. Message: {}", receive_ec.value(),
+                            receive_ec.message());
+    }
+
+    ArmTimer();
+    WaitForRequests();
+  }
+
+  // Parses the request. Requests for an operation of zero seconds are answered in the current batch, the
+  // other ones are queued until their operation is over.
+  void ProcessRequest(const char* request, std::size_t size, const asio::ip::udp::endpoint& sender) {
+    unsigned int duration_sec = 0;
+    if (!ParseRequest(request, size, duration_sec)) {
+      m_replies.Add(sender, "ERROR\n", 6);
+      return;
+    }
+
+    if (duration_sec == 0) {
+      m_replies.Add(sender, "OK\n", 3);
+      return;
+    }
+
+    if (m_pending.size() == MAX_PENDING_REPLIES) {
+      // Overloaded, the queue of deferred replies never grows beyond its preallocated capacity.
+      m_replies.Add(sender, "ERROR\n", 6);
+      return;
+    }
+
+    m_pending.push_back(
+        PendingReply{std::chrono::steady_clock::now() + std::chrono::seconds(duration_sec), sender});
+    std::push_heap(m_pending.begin(), m_pending.end(), std::greater<PendingReply>{});
+  }
+
+  // Accepts `EMULATE_LONG_COMP_OP [s]` with an optional trailing new-line.
+  static bool ParseRequest(const char* request, std::size_t size, unsigned int& duration_sec) {
+    static const char prefix[] = "EMULATE_LONG_COMP_OP ";
+    static const std::size_t prefix_len = sizeof(prefix) - 1;
+
+    if (size > 0 && request[size - 1] == '\n') --size;
+    if (size <= prefix_len || std::memcmp(request, prefix, prefix_len) != 0) return false;
+
+    duration_sec = 0;
+    for (std::size_t i = prefix_len; i < size; ++i) {
+      if (request[i] < '0' || request[i] > '9' || duration_sec > MAX_DURATION_SEC) return false;
+      duration_sec = duration_sec * 10 + static_cast<unsigned int>(request[i] - '0');
+    }
+    return duration_sec <= MAX_DURATION_SEC;
+  }
+
+  // While replies are deferred the timer ticks at a fixed rate, so a single wait is ever in flight and its
+  // memory can be reused.
+  void ArmTimer() {
+    if (m_timer_armed || m_pending.empty()) return;
+    m_timer_armed = true;
+
+    std::shared_ptr<HandlerMemory> memory = m_timer_memory;
+    m_timer.expires_from_now(TIMER_TICK);
+    m_timer.async_wait(
+        MakeCustomAllocHandler(*memory, [this, memory](const asio::error_code& ec) { onTimer(ec); }));
+  }
+
+  void onTimer(const asio::error_code& ec) {
+    m_timer_armed = false;
+    if (ec == asio::error::operation_aborted || m_isStopped.load()) return;
+
+    // Send the replies of all the operations that are over.
+    auto now = std::chrono::steady_clock::now();
+    m_replies.Clear();
+    while (!m_pending.empty() && m_pending.front().m_due <= now) {
+      if (m_replies.Full()) SendReplies();
+
+      m_replies.Add(m_pending.front().m_sender, "OK\n", 3);
+      std::pop_heap(m_pending.begin(), m_pending.end(), std::greater<PendingReply>{});
+      m_pending.pop_back();
+    }
+    SendReplies();
+
+    ArmTimer();
+  }
+
+  void SendReplies() {
+    asio::error_code ec;
+    std::size_t sent = SendDatagrams(m_sock, m_replies, ec);
+    if (ec) {
+      // The socket send buffer is full, the remaining replies are dropped like any lost datagram.
+      logging::get()->debug("Dropped {} replies: {}", m_replies.Size() - sent, ec.message());
+    }
+    m_replies.Clear();
+  }
+
+private:
+  // Maximum number of datagrams received or sent per system call.
+  static const std::size_t BATCH_SIZE = 64;
+  static const std::size_t MAX_DATAGRAM_SIZE = 512;
+
+  // Maximum number of requests whose emulated operation runs at the same time, per socket.
+  static const std::size_t MAX_PENDING_REPLIES = 64 * 1024;
+  static const unsigned int MAX_DURATION_SEC = 3600;
+
+  static constexpr std::chrono::milliseconds TIMER_TICK{10};
+
+  asio::ip::udp::socket m_sock;
+  asio::steady_timer m_timer;  // Sends the deferred replies that are due.
+  DatagramBatch m_requests;    // Receive batch, reused for every batch.
+  DatagramBatch m_replies;     // Replies being sent.
+
+  std::vector<PendingReply> m_pending;  // Deferred replies, a min-heap on the due time.
+  bool m_timer_armed;
+
+  std::shared_ptr<HandlerMemory> m_wait_memory;   // Memory of the readiness wait.
+  std::shared_ptr<HandlerMemory> m_timer_memory;  // Memory of the timer wait.
+  std::atomic<bool> m_isStopped;
+};
+
+constexpr std::chrono::milliseconds Service::TIMER_TICK;
+
+// Every thread runs its own io_service, pinned to its own CPU, and owns its own socket bound to the server
+// port with SO_REUSEPORT: the kernel spreads the datagrams across the sockets, so the threads share nothing.
+// Without SO_REUSEPORT a single socket served by the first thread is used.
+class Server {
+public:
+  Server() = default;
+
+  // Start the server.
+  void Start(unsigned short port_num, unsigned int thread_pool_size) {
+    assert(thread_pool_size > 0);
+
+#ifndef SO_REUSEPORT
+    thread_pool_size = 1;
+#endif
+
+    m_pool.reset(new IoServicePool(thread_pool_size, 1, true, IoServicePool::Dispatch::RoundRobin));
+
+    for (std::size_t shard = 0; shard < m_pool->Size(); ++shard) {
+      m_services.emplace_back(new Service(m_pool->GetIoService(shard), port_num, m_pool->Size() > 1));
+      m_services.back()->Start();
+    }
+
+    m_pool->Start();
+  }
+
+  // Stop the server.
+  void Stop() {
+    for (auto& service : m_services) {
+      service->Stop();
+    }
+    m_pool->Stop();
+  }
+
+private:
+  std::unique_ptr<IoServicePool> m_pool;
+  // One per shard. Destroyed before m_pool: their sockets and timers must not outlive the io_services.
+  std::vector<std::unique_ptr<Service>> m_services;
+};
+
+const unsigned int DEFAULT_THREAD_POOL_SIZE = 2;
+
+int main() {
+  auto console = logging::setup();
+
+  unsigned short port_num = 3333;
+
+  try {
+    Server srv;
+
+    unsigned int thread_pool_size = std::thread::hardware_concurrency();
+    if (thread_pool_size == 0) thread_pool_size = DEFAULT_THREAD_POOL_SIZE;
+
+    srv.Start(port_num, thread_pool_size);
+
+    std::this_thread::sleep_for(std::chrono::seconds(60));
+
+    srv.Stop();
+  } catch (asio::system_error& e) {
+    console->error("Error occured! Error code = {}. Message: {}", e.code().value(), e.what());
+    return e.code().value();
+  }
+
+  return 0;
+}
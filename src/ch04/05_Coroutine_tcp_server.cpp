@@ -0,0 +1,607 @@
+// The asynchronous server of 03_Async_parallel_tcp_server.cpp written with C++20 coroutines: the accept loop
+// and the read and write loops of every connection are plain loops suspended at each co_await, instead of
+// chains of completion handlers. Requires C++20 and asio 1.18 or later (asio::awaitable, asio::co_spawn), see
+// the ch04-coroutines Makefile target.
+
+#include "../common/arena.h"
+#include "../common/binary_frame.h"
+#include "../common/frame_reader.h"
+#include "../common/io_service_pool.h"
+#include "../common/logging.h"
+#include "../common/message_builder.h"
+#include "../common/thread_pool.h"
+#include "../common/timer_wheel.h"
+#include <asio.hpp>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Settings shared by all the connections served by the server.
+struct ServiceConfig {
+  // A connection that does not send a new request within this time is closed.
+  std::chrono::steady_clock::duration idle_timeout = std::chrono::seconds(30);
+
+  // A request must be received completely within this time of its first bytes, and a write of responses
+  // must complete within this time, otherwise the connection is closed.
+  std::chrono::steady_clock::duration read_timeout = std::chrono::seconds(10);
+  std::chrono::steady_clock::duration write_timeout = std::chrono::seconds(10);
+
+  // Number of requests served on a connection before it is closed, 0 means unlimited.
+  unsigned int max_requests_per_connection = 100;
+
+  // Maximum number of requests of a connection processed concurrently, the server stops reading from the
+  // connection while that many responses are pending.
+  std::size_t max_pipelined_requests = 32;
+
+  // Requests are processed by a separate pool of workers so that slow requests never block the threads
+  // running the event loops. When its queue is full new requests are answered with an error right away.
+  unsigned int compute_pool_size = 16;
+  std::size_t compute_queue_capacity = 1024;
+
+  // Maximum number of request payload buffers kept for reuse by binary protocol connections, and longest
+  // binary request payload accepted: a connection announcing a longer one is closed.
+  std::size_t max_free_payload_buffers = 1024;
+  std::uint32_t max_request_payload = BINARY_FRAME_MAX_REQUEST_PAYLOAD;
+
+  // The processing of a request is emulated with a CPU-bound loop and a sleep. The benchmarks (src/bench)
+  // turn it off to measure the server itself.
+  bool emulate_processing = true;
+};
+
+// Serves one persistent (keep-alive) connection carrying either newline-delimited text requests or length-
+// prefixed binary frames, told apart by the first byte the client sends. Requests are pipelined as in the
+// callback server: a reader coroutine dispatches every complete request to the compute pool right away, and a
+// writer coroutine writes the responses back, text ones in request order, binary ones as soon as they are
+// ready. Both coroutines run on the connection's strand. The writer waits for responses on a timer that never
+// expires, the reader waits on another one while the pipeline is full, and each wakes the other up by
+// cancelling its wait. The timeouts are tracked in the timer wheel of the server and close the socket, which
+// aborts the operations the coroutines are suspended on.
+// Every co_await of an asio operation allocates a coroutine frame for it, and every call of a coroutine one
+// for the callee. asio::awaitable takes no allocator: asio recycles the frames through a cache that holds a
+// single freed frame per thread. The loops therefore await the operations directly rather than through
+// nested coroutines, so that a frame is only allocated once the previous one has been freed and the cache
+// serves all of them. 10_Coroutine_server (src/bench) compares the allocations per request with the callback
+// server.
+class Connection : public std::enable_shared_from_this<Connection> {
+public:
+  Connection(asio::ip::tcp::socket sock, IoServicePool& pool, std::size_t shard, const ServiceConfig& config,
+             ThreadPool& compute_pool, PayloadPool& payload_pool, TimerWheel& timers)
+      : m_sock{std::move(sock)},
+        m_protocol{WireProtocol::Text},
+        m_binary_request{payload_pool, config.max_request_payload},
+        m_pool(pool),
+        m_shard{shard},
+        m_config(config),
+        m_compute_pool(compute_pool),
+        m_strand{asio::make_strand(pool.GetIoService(shard))},
+        m_wake_reader{pool.GetIoService(shard)},
+        m_wake_writer{pool.GetIoService(shard)},
+        m_timers(timers),
+        m_timeout{[this]() {
+          auto self = shared_from_this();
+          asio::post(m_strand, [self]() { self->onTimeout(); });
+        }},
+        m_deadline{std::chrono::steady_clock::time_point::max()},
+        m_num_requests{0},
+        m_first_seq{0},
+        m_num_writing{0},
+        m_reading{false},
+        m_partial_request{false},
+        m_read_closed{false},
+        m_finished{false} {}
+  ~Connection() { m_pool.Release(m_shard); }
+
+  void Start() {
+    asio::co_spawn(m_strand, Read(shared_from_this()), asio::detached);
+    asio::co_spawn(m_strand, Write(shared_from_this()), asio::detached);
+  }
+
+private:
+  // The coroutines run on the strand of the connection. Their executor is the strand type itself rather than
+  // the asio::any_io_executor of a default asio::awaitable, which is too small to hold a strand: asio would
+  // allocate a copy of the strand for every operation.
+  typedef asio::strand<asio::io_service::executor_type> Strand;
+  static constexpr asio::use_awaitable_t<Strand> USE_AWAITABLE{};
+
+  // Slot of the response queue, filled in when the compute pool is done with the request. The strings of the
+  // request live in its arena, which goes back to the cache of the thread when the slot is released.
+  struct PendingResponse {
+    PooledArena m_arena;
+    ArenaString m_response;
+    std::uint64_t m_request_id = 0;  // Echoed back in binary responses.
+    FrameType m_type = FrameType::Response;
+    unsigned char m_header[BINARY_FRAME_HEADER_SIZE];  // Encoded binary header, referenced by the write.
+    bool m_ready = false;
+    bool m_writing = false;  // Covered by the pending write.
+    bool m_sent = false;
+  };
+
+  // Reads the requests and dispatches them until the client is done sending, the request cap is hit or the
+  // connection fails. The parameter is copied into the coroutine frame, it keeps the connection alive for as
+  // long as the coroutine runs.
+  asio::awaitable<void, Strand> Read(std::shared_ptr<Connection> /* self */) {
+    asio::error_code ec;
+    asio::error_code ignored_ec;
+
+    // Wait for the first bytes without consuming them, they tell which protocol the client speaks.
+    m_reading = true;
+    UpdateTimeout();
+    co_await m_sock.async_wait(asio::ip::tcp::socket::wait_read,
+                               asio::redirect_error(USE_AWAITABLE, ec));
+    if (!ec) {
+      unsigned char first = 0;
+      asio::error_code peek_ec;
+      m_sock.receive(asio::buffer(&first, 1), asio::socket_base::message_peek, peek_ec);
+      if (!peek_ec && first == BINARY_FRAME_MAGIC) m_protocol = WireProtocol::Binary;
+    }
+
+    // Lets the text requests of an idle connection be received without blocking the thread.
+    m_sock.non_blocking(true, ignored_ec);
+
+    while (!ec) {
+      // Dispatch the complete requests sitting in the receive buffer, a read may bring several of them.
+      FrameView request;
+      while (m_protocol == WireProtocol::Text && CanAcceptRequest() && m_request.Next(request)) {
+        DispatchRequest(request, 0);
+      }
+
+      // The read timeout of a request runs from its first bytes, not from the last read.
+      if (m_protocol == WireProtocol::Text && m_request.Pending() != 0) {
+        if (!m_partial_request) m_read_started = std::chrono::steady_clock::now();
+        m_partial_request = true;
+      } else {
+        m_partial_request = false;
+      }
+
+      if (m_finished || RequestCapReached()) break;
+
+      if (!CanAcceptRequest()) {
+        // The pipeline is full, wait until the writer has sent responses.
+        m_wake_reader.expires_at(asio::steady_timer::time_point::max());
+        co_await m_wake_reader.async_wait(asio::redirect_error(USE_AWAITABLE, ignored_ec));
+        continue;
+      }
+
+      if (m_request.Full()) {
+        logging::get()->error("Request exceeds the maximum size, closing the connection.");
+        Finish();
+        break;
+      }
+
+      m_reading = true;
+      UpdateTimeout();
+
+      if (m_protocol == WireProtocol::Binary) {
+        // One frame per iteration: an exact-size read of the header, then one of the payload.
+        co_await asio::async_read(m_sock, m_binary_request.HeaderBuffer(),
+                                  asio::redirect_error(USE_AWAITABLE, ec));
+        if (!ec &&
+            (!m_binary_request.DecodeHeader() || m_binary_request.Header().type != FrameType::Request)) {
+          ec = asio::error::invalid_argument;
+        }
+        if (!ec) {
+          m_partial_request = true;
+          m_read_started = std::chrono::steady_clock::now();
+          UpdateTimeout();
+          co_await asio::async_read(m_sock, m_binary_request.PayloadBuffer(),
+                                    asio::redirect_error(USE_AWAITABLE, ec));
+          m_partial_request = false;
+        }
+
+        m_reading = false;
+        UpdateTimeout();
+        if (ec) break;
+
+        DispatchRequest(m_binary_request.Payload(), m_binary_request.Header().request_id);
+        m_binary_request.Release();
+        continue;
+      }
+
+      std::size_t bytes_transferred = 0;
+      if (m_request.Pending() == 0) {
+        // Nothing is buffered: wait for the next request without holding a receive buffer, so that idle
+        // connections keep no buffer memory, then receive it into a buffer taken from the cache of this
+        // thread.
+        m_request.Release();
+        co_await m_sock.async_wait(asio::ip::tcp::socket::wait_read,
+                                   asio::redirect_error(USE_AWAITABLE, ec));
+        if (!ec) {
+          bytes_transferred = m_sock.read_some(m_request.Prepare(), ec);
+          if (ec == asio::error::would_block) ec = asio::error_code{};  // Spurious wake-up, wait again.
+        }
+      } else {
+        // Receive straight into the frame reader, the requests are split out of it without copying.
+        bytes_transferred = co_await m_sock.async_read_some(m_request.Prepare(),
+                                                            asio::redirect_error(USE_AWAITABLE, ec));
+      }
+
+      m_reading = false;
+      UpdateTimeout();
+      if (ec) break;
+
+      m_request.Commit(bytes_transferred);
+    }
+
+    if (ec == asio::error::eof) {
+      // The client is done sending. Responses still in flight are written before the connection ends.
+      m_read_closed = true;
+      if (m_responses.empty()) Finish();
+    } else if (ec) {
+      if (ec != asio::error::operation_aborted) {
+        logging::get()->error("Error occurred! Error code = {}. Message: {}", ec.value(), ec.message());
+      }
+      Finish();
+    }
+  }
+
+  // Writes the responses as they get ready until the connection is finished, all the ready ones at the head
+  // of the queue with a single gather operation.
+  asio::awaitable<void, Strand> Write(std::shared_ptr<Connection> /* self */) {
+    while (!m_finished) {
+      if (!PrepareResponses()) {
+        // Nothing to write, wait until a response is ready.
+        asio::error_code ignored_ec;
+        m_wake_writer.expires_at(asio::steady_timer::time_point::max());
+        co_await m_wake_writer.async_wait(asio::redirect_error(USE_AWAITABLE, ignored_ec));
+        continue;
+      }
+
+      m_write_started = std::chrono::steady_clock::now();
+      UpdateTimeout();
+
+      asio::error_code ec;
+      co_await asio::async_write(m_sock, m_write_msg.Buffers(),
+                                 asio::redirect_error(USE_AWAITABLE, ec));
+      if (ec) {
+        if (ec != asio::error::operation_aborted) {
+          logging::get()->error("Error occurred! Error code = {}. Message: {}", ec.value(), ec.message());
+        }
+        Finish();
+        break;
+      }
+
+      for (auto& slot : m_responses) {
+        if (!slot.m_writing) continue;
+        slot.m_writing = false;
+        slot.m_sent = true;
+      }
+      m_num_writing = 0;
+
+      // Slots are released in order, the ones sent ahead of an earlier response wait for it.
+      bool pipeline_full = m_responses.size() >= m_config.max_pipelined_requests;
+      while (!m_responses.empty() && m_responses.front().m_sent) {
+        m_responses.pop_front();
+        ++m_first_seq;
+      }
+
+      if (m_responses.empty() && (m_read_closed || RequestCapReached())) {
+        Finish();
+        break;
+      }
+
+      if (pipeline_full) m_wake_reader.cancel();
+
+      // Everything may have been answered, the connection is then idle until the pending read completes.
+      UpdateTimeout();
+    }
+  }
+
+  // Puts the responses ready to be written into m_write_msg. Binary responses carry the id of their request,
+  // so they are written as soon as they are ready and a slow request does not hold back the ones after it.
+  // Text responses are written in request order. Returns false if there is nothing to write.
+  bool PrepareResponses() {
+    m_write_msg.Clear();
+    for (auto& slot : m_responses) {
+      if (slot.m_sent) continue;
+      if (m_write_msg.Available() < 2) break;  // Full, the rest goes with the next write.
+      if (!slot.m_ready) {
+        if (m_protocol == WireProtocol::Binary) continue;
+        break;
+      }
+
+      if (m_protocol == WireProtocol::Binary) {
+        AppendBinaryFrame(m_write_msg, slot.m_header, slot.m_type, slot.m_request_id, slot.m_response.data(),
+                          slot.m_response.size());
+      } else {
+        m_write_msg.Append(slot.m_response.data(), slot.m_response.size()).Append("\n");
+      }
+      slot.m_writing = true;
+      ++m_num_writing;
+    }
+
+    return m_num_writing != 0;
+  }
+
+  bool CanAcceptRequest() const {
+    return !m_finished && !m_read_closed && !RequestCapReached() &&
+           m_responses.size() < m_config.max_pipelined_requests;
+  }
+
+  bool RequestCapReached() const {
+    return m_config.max_requests_per_connection != 0 &&
+           m_num_requests >= m_config.max_requests_per_connection;
+  }
+
+  // Copy the request out of the receive buffer, which the next read reuses, into the arena of the request
+  // and hand it over to the compute pool. Its response gets the next slot of the response queue. The arena is
+  // only used by one thread at a time: this one until the task is queued, then the compute pool until its
+  // result is posted back.
+  void DispatchRequest(const FrameView& frame, std::uint64_t request_id) {
+    ++m_num_requests;
+
+    std::uint64_t seq = m_first_seq + m_responses.size();
+    m_responses.emplace_back();
+    PendingResponse& slot = m_responses.back();
+    slot.m_request_id = request_id;
+    slot.m_arena = ArenaCache::Acquire();
+
+    Arena* arena = slot.m_arena.get();
+    ArenaString request{frame.data, frame.size, ArenaAllocator<char>{*arena}};
+
+    auto self = shared_from_this();
+    bool queued = m_compute_pool.Post([self, seq, arena, request = std::move(request)]() mutable {
+      // The request is moved out of the task so that it is gone before the arena is handed back to the
+      // connection, the task itself is only destroyed after the response has been posted.
+      ArenaString response = self->ProcessRequest(ArenaString{std::move(request)}, *arena);
+      asio::post(self->m_strand, [self, seq, response = std::move(response)]() mutable {
+        self->onRequestProcessed(seq, std::move(response));
+      });
+    });
+
+    if (!queued) {
+      logging::get()->warn("Compute pool is saturated, rejecting the request.");
+      onRequestProcessed(seq, ArenaString{"ERROR", ArenaAllocator<char>{*arena}}, FrameType::Error);
+    }
+  }
+
+  // Executed through the strand.
+  void onRequestProcessed(std::uint64_t seq, ArenaString response, FrameType type = FrameType::Response) {
+    if (m_finished) return;
+
+    PendingResponse& slot = m_responses[static_cast<std::size_t>(seq - m_first_seq)];
+    slot.m_response = std::move(response);
+    slot.m_type = type;
+    slot.m_ready = true;
+
+    m_wake_writer.cancel();
+  }
+
+  // Executed by the compute pool, must not touch the state owned by the strand. Transient data, the response
+  // included, is allocated in the arena of the request.
+  ArenaString ProcessRequest(const ArenaString& /* request */, Arena& arena) const {
+    // In this method we parse the request, process it and prepare the response.
+    if (m_config.emulate_processing) {
+      // emulate CPU-consuming operations.
+      int i = 0;
+      while (i != 1000000) i++;
+
+      // Emulate operations that block the thread (e.g. sync I/O operations).
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+
+    // Prepare and return the response message. The framing is added when it is written.
+    ArenaString response{"Response", ArenaAllocator<char>{arena}};
+    return response;
+  }
+
+  // Arms the timeout of what the connection is waiting for:
+  // - a write in progress must complete within the write timeout;
+  // - a request whose first bytes have arrived must be complete within the read timeout;
+  // - with nothing else in progress, the next request must arrive within the idle timeout.
+  // Nothing is armed while requests are being processed, nor once the connection is finished.
+  void UpdateTimeout() {
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    if (m_finished) {
+      // The operations still pending are aborted.
+    } else if (m_num_writing != 0) {
+      deadline = m_write_started + m_config.write_timeout;
+    } else if (m_reading && m_responses.empty()) {
+      deadline = m_partial_request ? m_read_started + m_config.read_timeout
+                                   : std::chrono::steady_clock::now() + m_config.idle_timeout;
+    }
+
+    if (deadline == m_deadline) return;
+    m_deadline = deadline;
+
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+      m_timers.Cancel(m_timeout);
+    } else {
+      m_timers.Arm(m_timeout, deadline, shared_from_this());
+    }
+  }
+
+  // Executed through the strand.
+  void onTimeout() {
+    // The timeout has been cancelled or moved since the timer expired.
+    if (m_finished || std::chrono::steady_clock::now() < m_deadline) return;
+
+    logging::get()->debug("Closing the connection, {} timeout.",
+                          m_num_writing != 0 ? "write" : m_partial_request ? "read" : "idle");
+
+    // Closing the socket aborts the operations the coroutines wait for, which then finish the connection.
+    asio::error_code ignored_ec;
+    m_sock.close(ignored_ec);
+  }
+
+  void Finish() {
+    m_finished = true;
+    UpdateTimeout();
+
+    asio::error_code ignored_ec;
+    m_sock.shutdown(asio::ip::tcp::socket::shutdown_both, ignored_ec);
+    m_sock.close(ignored_ec);
+
+    // A coroutine waiting for the other one sees that the connection is finished and returns.
+    m_wake_reader.cancel();
+    m_wake_writer.cancel();
+  }
+
+private:
+  asio::ip::tcp::socket m_sock;
+  WireProtocol m_protocol;             // Detected from the first byte received.
+  FrameReader m_request;               // Receive buffer the text requests are framed in.
+  BinaryFrameReader m_binary_request;  // Reads binary requests into pooled payload buffers.
+  MessageBuilder m_write_msg;          // Responses being written.
+
+  IoServicePool& m_pool;  // Pool the socket's io_service belongs to.
+  std::size_t m_shard;    // Shard of the pool serving this connection.
+  const ServiceConfig& m_config;
+  ThreadPool& m_compute_pool;  // Workers processing the requests.
+
+  Strand m_strand;                   // Runs the coroutines and the timeouts.
+  asio::steady_timer m_wake_reader;  // Waited on by the reader while the pipeline is full.
+  asio::steady_timer m_wake_writer;  // Waited on by the writer while no response is ready.
+  TimerWheel& m_timers;                                    // Timer wheel of the connection's shard.
+  TimerWheel::Timer m_timeout;                             // Closes the connection once m_deadline passes.
+  std::chrono::steady_clock::time_point m_deadline;
+  std::chrono::steady_clock::time_point m_read_started;   // First bytes of the request being received.
+  std::chrono::steady_clock::time_point m_write_started;  // Start of the write in progress.
+
+  unsigned int m_num_requests;              // Number of requests received on this connection so far.
+  std::deque<PendingResponse> m_responses;  // Requests being processed or answered, in arrival order.
+  std::uint64_t m_first_seq;                // Sequence number of m_responses.front().
+  std::size_t m_num_writing;                // Number of responses covered by the pending write.
+  bool m_reading;                           // A read is pending.
+  bool m_partial_request;                   // The first bytes of a request have been received.
+  bool m_read_closed;                       // The client is done sending.
+  bool m_finished;                          // The connection has been closed.
+};
+
+class Acceptor {
+public:
+  Acceptor(IoServicePool& pool, unsigned short port_num, const ServiceConfig& config,
+           ThreadPool& compute_pool, PayloadPool& payload_pool, TimerWheel& timers)
+      : m_pool(pool),
+        m_config(config),
+        m_compute_pool(compute_pool),
+        m_payload_pool(payload_pool),
+        m_timers(timers),
+        m_acceptor{m_pool.GetIoService(0), asio::ip::tcp::endpoint(asio::ip::address_v4::any(), port_num)},
+        m_isStopped{false} {}
+
+  // Start accepting incoming connection requests.
+  void Start() {
+    m_acceptor.listen();
+    asio::co_spawn(m_acceptor.get_executor(), Accept(), asio::detached);
+  }
+
+  // Stop accepting incomming connection requests.
+  void Stop() {
+    m_isStopped.store(true);
+    asio::post(m_acceptor.get_executor(), [this]() { m_acceptor.close(); });
+  }
+
+private:
+  asio::awaitable<void> Accept() {
+    while (!m_isStopped.load()) {
+      // The socket is created on the io_service of the shard that is going to serve the connection.
+      std::size_t shard = m_pool.Acquire();
+      asio::ip::tcp::socket sock{m_pool.GetIoService(shard)};
+
+      asio::error_code ec;
+      co_await m_acceptor.async_accept(sock, asio::redirect_error(asio::use_awaitable, ec));
+      if (ec) {
+        m_pool.Release(shard);
+        if (ec != asio::error::operation_aborted) {
+          logging::get()->error("Error occured! Error code = {}. Message: {}", ec.value(), ec.message());
+        }
+        continue;
+      }
+
+      std::make_shared<Connection>(std::move(sock), m_pool, shard, m_config, m_compute_pool, m_payload_pool,
+                                   m_timers)
+          ->Start();
+    }
+  }
+
+private:
+  IoServicePool& m_pool;
+  const ServiceConfig& m_config;
+  ThreadPool& m_compute_pool;
+  PayloadPool& m_payload_pool;
+  TimerWheel& m_timers;
+  asio::ip::tcp::acceptor m_acceptor;
+  std::atomic<bool> m_isStopped;
+};
+
+class Server {
+public:
+  explicit Server(const ServiceConfig& config = ServiceConfig{})
+      : m_config(config), m_payload_pool{PayloadBufferFactory(), config.max_free_payload_buffers} {}
+
+  // Start the server. All the threads run one shared io_service, every connection is kept consistent by its
+  // own strand.
+  void Start(unsigned short port_num, unsigned int thread_pool_size) {
+    assert(thread_pool_size > 0);
+
+    m_compute_pool.reset(new ThreadPool(m_config.compute_pool_size, m_config.compute_queue_capacity));
+    m_pool.reset(new IoServicePool(1, thread_pool_size, false, IoServicePool::Dispatch::RoundRobin));
+    m_timers.reset(new TimerWheel(m_pool->GetIoService(0), TIMER_TICK));
+
+    m_acceptor.reset(new Acceptor(*m_pool, port_num, m_config, *m_compute_pool, m_payload_pool, *m_timers));
+    m_acceptor->Start();
+
+    // Start the threads running the event loops.
+    m_pool->Start();
+  }
+
+  // Stop the server.
+  void Stop() {
+    m_acceptor->Stop();
+    m_compute_pool->Stop();
+    m_pool->Stop();
+  }
+
+private:
+  // Resolution of the connection timeouts.
+  static constexpr std::chrono::milliseconds TIMER_TICK{100};
+
+  ServiceConfig m_config;
+  PayloadPool m_payload_pool;  // Declared before m_pool, the connections give their buffers back to it.
+  std::unique_ptr<IoServicePool> m_pool;
+
+  // Destroyed before m_pool: its asio timer must not outlive the io_service. A tick wait still queued in the
+  // io_service keeps its own memory alive until the io_service is done with it.
+  std::unique_ptr<TimerWheel> m_timers;
+  std::unique_ptr<ThreadPool> m_compute_pool;  // Destroyed before m_pool, its tasks post to the strands.
+  std::unique_ptr<Acceptor> m_acceptor;
+};
+
+constexpr std::chrono::milliseconds Server::TIMER_TICK;
+
+const unsigned int DEFAULT_THREAD_POOL_SIZE = 2;
+
+// The benchmarks (src/bench) include the server without its main().
+#ifndef RECIPE_NO_MAIN
+int main() {
+  auto console = logging::setup();
+
+  unsigned short port_num = 3333;
+
+  try {
+    Server srv;
+
+    // The I/O threads never block, so one event loop per CPU is enough.
+    unsigned int thread_pool_size = std::thread::hardware_concurrency();
+    if (thread_pool_size == 0) thread_pool_size = DEFAULT_THREAD_POOL_SIZE;
+
+    srv.Start(port_num, thread_pool_size);
+
+    std::this_thread::sleep_for(std::chrono::seconds(60));
+
+    srv.Stop();
+  } catch (asio::system_error& e) {
+    logging::get()->error("Error occured! Error code = {}. Message: {}", e.code().value(), e.what());
+    return e.code().value();
+  }
+
+  return 0;
+}
+#endif /* RECIPE_NO_MAIN */
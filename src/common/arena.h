@@ -0,0 +1,218 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Monotonic allocator for the transient data of a request (its copy of the request, the response, parse
+// results). Allocations bump a pointer through a chain of blocks and are never freed one by one: Reset()
+// discards all of them at once when the request is over. If a request needed more than one block, Reset()
+// replaces the chain with a single block as large as all of them, so in steady state the requests of the same
+// shape allocate nothing from the heap. Not thread-safe: the threads working on a request must hand it over
+// to each other (e.g. by posting to an io_service).
+class Arena {
+public:
+  explicit Arena(std::size_t block_size = 1024)
+      : m_head{nullptr}, m_ptr{nullptr}, m_end{nullptr}, m_block_size{block_size} {}
+  ~Arena() { FreeBlocks(); }
+  Arena(const Arena& src) = delete;
+  Arena& operator=(const Arena& rhs) = delete;
+
+  void* Allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t)) {
+    char* p = m_head != nullptr ? Align(m_ptr, alignment) : nullptr;
+    if (p == nullptr || p > m_end || size > static_cast<std::size_t>(m_end - p)) {
+      AddBlock(size + alignment);
+      p = Align(m_ptr, alignment);
+    }
+
+    m_ptr = p + size;
+    return p;
+  }
+
+  // Memory is only reclaimed by Reset(). Does not touch the arena, so a stale object may still be destroyed
+  // after the arena has moved on to another request.
+  void Deallocate(void* /* pointer */, std::size_t /* size */) {}
+
+  // Discards everything allocated so far. Objects still using the memory of the arena must be gone.
+  void Reset() {
+    if (m_head == nullptr) return;
+
+    if (m_head->m_next != nullptr) {
+      std::size_t total = Capacity();
+      FreeBlocks();
+      AddBlock(total);
+    }
+
+    m_ptr = m_head->Data();
+    m_end = m_ptr + m_head->m_size;
+  }
+
+  // Total size of the blocks of the arena.
+  std::size_t Capacity() const {
+    std::size_t total = 0;
+    for (Block* block = m_head; block != nullptr; block = block->m_next) total += block->m_size;
+    return total;
+  }
+
+private:
+  struct Block {
+    Block* m_next;
+    std::size_t m_size;
+
+    char* Data() { return reinterpret_cast<char*>(this + 1); }
+  };
+
+  static char* Align(char* p, std::size_t alignment) {
+    std::uintptr_t value = reinterpret_cast<std::uintptr_t>(p);
+    return p + ((alignment - value % alignment) % alignment);
+  }
+
+  // Chains a block of at least `size` bytes. The blocks double in size, so a large request needs few of them.
+  void AddBlock(std::size_t size) {
+    if (size < m_block_size) size = m_block_size;
+    m_block_size = size * 2;
+
+    Block* block = static_cast<Block*>(::operator new(sizeof(Block) + size));
+    block->m_next = m_head;
+    block->m_size = size;
+    m_head = block;
+    m_ptr = block->Data();
+    m_end = m_ptr + size;
+  }
+
+  void FreeBlocks() {
+    while (m_head != nullptr) {
+      Block* next = m_head->m_next;
+      ::operator delete(m_head);
+      m_head = next;
+    }
+    m_ptr = m_end = nullptr;
+  }
+
+private:
+  Block* m_head;             // Block currently allocated from, the older ones follow it.
+  char* m_ptr;               // Start of the free space of the current block.
+  char* m_end;               // End of the current block.
+  std::size_t m_block_size;  // Minimum size of the next block.
+};
+
+// Standard allocator allocating from an Arena. A default-constructed allocator has no arena and uses the
+// heap, so containers holding nothing yet do not need one. The allocator moves with the contents of a
+// container.
+template <typename T>
+class ArenaAllocator {
+public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  ArenaAllocator() noexcept : m_arena{nullptr} {}
+  explicit ArenaAllocator(Arena& arena) noexcept : m_arena{&arena} {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& other) noexcept : m_arena{other.m_arena} {}
+
+  T* allocate(std::size_t n) {
+    if (m_arena == nullptr) return static_cast<T*>(::operator new(n * sizeof(T)));
+    return static_cast<T*>(m_arena->Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* pointer, std::size_t n) noexcept {
+    if (m_arena == nullptr) {
+      ::operator delete(pointer);
+    } else {
+      m_arena->Deallocate(pointer, n * sizeof(T));
+    }
+  }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const {
+    return m_arena == other.m_arena;
+  }
+
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const {
+    return m_arena != other.m_arena;
+  }
+
+private:
+  template <typename U>
+  friend class ArenaAllocator;
+
+  Arena* m_arena;
+};
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> ArenaString;
+
+// Gives an arena back to the cache of the calling thread when its owner is done with it.
+struct ArenaRecycler {
+  void operator()(Arena* arena) const;
+};
+
+typedef std::unique_ptr<Arena, ArenaRecycler> PooledArena;
+
+// Per-thread cache of arenas, so that every request gets a warm arena instead of allocating its blocks. An
+// arena may be released by another thread than the one that acquired it, it then joins the cache of the
+// releasing thread. Up to MAX_FREE arenas are kept per thread; those grown beyond MAX_CAPACITY by an
+// unusually large request are freed instead.
+class ArenaCache {
+public:
+  static const std::size_t MAX_FREE = 64;
+  static const std::size_t MAX_CAPACITY = 64 * 1024;
+
+  static PooledArena Acquire() {
+    ArenaCache* cache = ForThisThread();
+    if (cache != nullptr && !cache->m_free.empty()) {
+      Arena* arena = cache->m_free.back();
+      cache->m_free.pop_back();
+      return PooledArena{arena};
+    }
+
+    return PooledArena{new Arena};
+  }
+
+  static void Recycle(Arena* arena) {
+    ArenaCache* cache = ForThisThread();
+    if (cache != nullptr && cache->m_free.size() < MAX_FREE && arena->Capacity() <= MAX_CAPACITY) {
+      arena->Reset();
+      cache->m_free.push_back(arena);
+      return;
+    }
+
+    delete arena;
+  }
+
+private:
+  ArenaCache() { m_free.reserve(MAX_FREE); }
+  ~ArenaCache() {
+    Exited() = true;
+    for (Arena* arena : m_free) delete arena;
+  }
+  ArenaCache(const ArenaCache& src) = delete;
+  ArenaCache& operator=(const ArenaCache& rhs) = delete;
+
+  // Returns the cache of the calling thread, or null once the thread is tearing down its thread-local
+  // objects.
+  static ArenaCache* ForThisThread() {
+    if (Exited()) return nullptr;
+    thread_local ArenaCache cache;
+    return &cache;
+  }
+
+  static bool& Exited() {
+    thread_local bool exited = false;
+    return exited;
+  }
+
+private:
+  std::vector<Arena*> m_free;
+};
+
+inline void ArenaRecycler::operator()(Arena* arena) const { ArenaCache::Recycle(arena); }
+
+#endif /* ARENA_H */
@@ -0,0 +1,235 @@
+#ifndef BINARY_FRAME_H
+#define BINARY_FRAME_H
+
+#include "frame_reader.h"
+#include "object_pool.h"
+#include <asio.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Length-prefixed binary framing. Every message is a fixed-size header followed by `length` payload bytes,
+// so a frame is read with two exact-size reads and the payload may carry arbitrary bytes. Header layout,
+// all integers big-endian:
+//   offset 0      magic (BINARY_FRAME_MAGIC)
+//   offset 1      type
+//   offset 2..3   flags
+//   offset 4..7   payload length
+//   offset 8..15  request id
+// The magic byte is not valid ASCII, so a server can tell a binary connection from a text one by its first
+// byte and serve both on the same port.
+
+const unsigned char BINARY_FRAME_MAGIC = 0xB5;
+const std::size_t BINARY_FRAME_HEADER_SIZE = 16;
+const std::uint32_t BINARY_FRAME_MAX_PAYLOAD = 16 * 1024 * 1024;
+
+// Largest request payload the servers accept by default. The requests are short commands, a bigger frame is
+// rejected before its payload is read.
+const std::uint32_t BINARY_FRAME_MAX_REQUEST_PAYLOAD = 64 * 1024;
+
+// Payload buffers grown beyond this size are freed instead of going back to the pool, so that a few large
+// frames do not leave every free buffer of the pool holding megabytes.
+const std::size_t BINARY_FRAME_POOLED_PAYLOAD = 64 * 1024;
+
+// Application protocol spoken over a connection.
+enum class WireProtocol { Text, Binary };
+
+enum class FrameType : std::uint8_t { Request = 1, Response = 2, Error = 3 };
+
+struct BinaryFrameHeader {
+  FrameType type = FrameType::Request;
+  std::uint16_t flags = 0;
+  std::uint32_t length = 0;
+  std::uint64_t request_id = 0;
+
+  void Encode(unsigned char* out) const {
+    out[0] = BINARY_FRAME_MAGIC;
+    out[1] = static_cast<unsigned char>(type);
+    PutBigEndian(out + 2, flags, 2);
+    PutBigEndian(out + 4, length, 4);
+    PutBigEndian(out + 8, request_id, 8);
+  }
+
+  // Returns false if the bytes are not a valid header, or announce a payload longer than `max_payload`.
+  bool Decode(const unsigned char* in, std::uint32_t max_payload = BINARY_FRAME_MAX_PAYLOAD) {
+    if (in[0] != BINARY_FRAME_MAGIC) return false;
+
+    type = static_cast<FrameType>(in[1]);
+    flags = static_cast<std::uint16_t>(GetBigEndian(in + 2, 2));
+    length = static_cast<std::uint32_t>(GetBigEndian(in + 4, 4));
+    request_id = GetBigEndian(in + 8, 8);
+    return length <= max_payload;
+  }
+
+private:
+  static void PutBigEndian(unsigned char* out, std::uint64_t value, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) {
+      out[size - 1 - i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+  }
+
+  static std::uint64_t GetBigEndian(const unsigned char* in, std::size_t size) {
+    std::uint64_t value = 0;
+    for (std::size_t i = 0; i < size; ++i) value = (value << 8) | in[i];
+    return value;
+  }
+};
+
+// Payload buffers are shared through a pool: a connection only holds one while a frame is being read and
+// processed, so idle connections keep no payload memory.
+typedef ObjectPool<std::vector<char>> PayloadPool;
+
+inline PayloadPool::Factory PayloadBufferFactory() {
+  return []() { return std::make_shared<std::vector<char>>(); };
+}
+
+// Reads binary frames from a stream: one exact-size read for the header, one for the payload. A header
+// announcing more than `max_payload` bytes fails the read.
+class BinaryFrameReader {
+public:
+  explicit BinaryFrameReader(PayloadPool& pool, std::uint32_t max_payload = BINARY_FRAME_MAX_PAYLOAD)
+      : m_pool(pool), m_max_payload{max_payload} {}
+  BinaryFrameReader(const BinaryFrameReader& src) = delete;
+  BinaryFrameReader& operator=(const BinaryFrameReader& rhs) = delete;
+  ~BinaryFrameReader() { Release(); }
+
+  // Reads the next frame synchronously, throwing asio::system_error on failure.
+  template <typename Stream>
+  void Read(Stream& stream) {
+    asio::read(stream, asio::buffer(m_header_buf));
+    if (!DecodeHeader()) throw asio::system_error(asio::error::invalid_argument);
+
+    asio::read(stream, PreparePayload());
+  }
+
+  // Reads the next frame asynchronously. The handler signature is void(const asio::error_code&).
+  template <typename Stream, typename Handler>
+  void AsyncRead(Stream& stream, Handler handler);
+
+  // Steps of a read driven by the caller (e.g. a coroutine): read HeaderBuffer() completely, decode it with
+  // DecodeHeader(), which returns false if the header is not valid, then read PayloadBuffer() completely.
+  asio::mutable_buffers_1 HeaderBuffer() { return asio::buffer(m_header_buf); }
+  bool DecodeHeader() { return m_header.Decode(m_header_buf, m_max_payload); }
+  asio::mutable_buffers_1 PayloadBuffer() { return PreparePayload(); }
+
+  const BinaryFrameHeader& Header() const { return m_header; }
+
+  // View of the payload of the last frame read. Valid until Release() or the next read.
+  FrameView Payload() const {
+    FrameView view;
+    if (m_payload) {
+      view.data = m_payload->data();
+      view.size = m_header.length;
+    }
+    return view;
+  }
+
+  // Gives the payload buffer back to the pool, or frees it if a large frame made it grow beyond
+  // BINARY_FRAME_POOLED_PAYLOAD.
+  void Release() {
+    if (m_payload && m_payload->capacity() <= BINARY_FRAME_POOLED_PAYLOAD) {
+      m_pool.Recycle(std::move(m_payload));
+    }
+    m_payload.reset();
+  }
+
+private:
+  template <typename Stream, typename Handler>
+  friend class ReadBinaryFrameOp;
+
+  asio::mutable_buffers_1 PreparePayload() {
+    if (!m_payload) m_payload = m_pool.Acquire();
+    if (m_payload->size() < m_header.length) m_payload->resize(m_header.length);
+    return asio::buffer(m_payload->data(), m_header.length);
+  }
+
+private:
+  PayloadPool& m_pool;
+  std::uint32_t m_max_payload;
+  unsigned char m_header_buf[BINARY_FRAME_HEADER_SIZE];
+  BinaryFrameHeader m_header;
+  std::shared_ptr<std::vector<char>> m_payload;
+};
+
+// Composed operation behind BinaryFrameReader::AsyncRead. Allocation and invocation hooks are forwarded to
+// the user's handler, so custom handler allocation and strands keep working.
+template <typename Stream, typename Handler>
+class ReadBinaryFrameOp {
+public:
+  ReadBinaryFrameOp(Stream& stream, BinaryFrameReader& reader, Handler handler)
+      : m_stream(stream), m_reader(reader), m_handler(std::move(handler)), m_header_done{false} {}
+
+  void Start() { asio::async_read(m_stream, asio::buffer(m_reader.m_header_buf), std::move(*this)); }
+
+  void operator()(const asio::error_code& ec, std::size_t /* bytes_transferred */) {
+    if (ec || m_header_done) {
+      m_handler(ec);
+      return;
+    }
+
+    if (!m_reader.DecodeHeader()) {
+      m_handler(asio::error::invalid_argument);
+      return;
+    }
+
+    m_header_done = true;
+    asio::async_read(m_stream, m_reader.PreparePayload(), std::move(*this));
+  }
+
+  template <typename Function>
+  friend void asio_handler_invoke(Function& function, ReadBinaryFrameOp* op) {
+    using asio::asio_handler_invoke;
+    asio_handler_invoke(function, std::addressof(op->m_handler));
+  }
+
+  template <typename Function>
+  friend void asio_handler_invoke(const Function& function, ReadBinaryFrameOp* op) {
+    using asio::asio_handler_invoke;
+    asio_handler_invoke(function, std::addressof(op->m_handler));
+  }
+
+  friend void* asio_handler_allocate(std::size_t size, ReadBinaryFrameOp* op) {
+    using asio::asio_handler_allocate;
+    return asio_handler_allocate(size, std::addressof(op->m_handler));
+  }
+
+  friend void asio_handler_deallocate(void* pointer, std::size_t size, ReadBinaryFrameOp* op) {
+    using asio::asio_handler_deallocate;
+    asio_handler_deallocate(pointer, size, std::addressof(op->m_handler));
+  }
+
+private:
+  Stream& m_stream;
+  BinaryFrameReader& m_reader;
+  Handler m_handler;
+  bool m_header_done;
+};
+
+template <typename Stream, typename Handler>
+inline void BinaryFrameReader::AsyncRead(Stream& stream, Handler handler) {
+  ReadBinaryFrameOp<Stream, Handler>(stream, *this, std::move(handler)).Start();
+}
+
+// Encodes a frame header into `header_buf` and appends the frame (header and payload) to the builder.
+template <typename Builder>
+inline void AppendBinaryFrame(Builder& msg, unsigned char* header_buf, FrameType type,
+                              std::uint64_t request_id, const void* payload, std::size_t size) {
+  BinaryFrameHeader header;
+  header.type = type;
+  header.length = static_cast<std::uint32_t>(size);
+  header.request_id = request_id;
+  header.Encode(header_buf);
+
+  msg.Append(header_buf, BINARY_FRAME_HEADER_SIZE).Append(payload, size);
+}
+
+// Tells whether a connection speaks the binary protocol by peeking at its first byte without consuming it.
+// Blocks until the byte is available.
+inline WireProtocol DetectProtocol(asio::ip::tcp::socket& sock) {
+  unsigned char first = 0;
+  sock.receive(asio::buffer(&first, 1), asio::socket_base::message_peek);
+  return first == BINARY_FRAME_MAGIC ? WireProtocol::Binary : WireProtocol::Text;
+}
+
+#endif /* BINARY_FRAME_H */
@@ -0,0 +1,123 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// A multi-producer/multi-consumer FIFO queue holding at most a fixed number of items. Producers either wait
+// for room (Push), give up right away (TryPush) or make room by removing the oldest item (PushShedOldest);
+// consumers wait until an item is available or the queue is closed. The queue keeps track of its peak depth
+// and of the producers it made wait, to tell how close to saturation it runs.
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(std::size_t capacity)
+      : m_capacity{capacity}, m_closed{false}, m_max_size{0}, m_blocked_pushes{0} {}
+  BoundedQueue(const BoundedQueue& src) = delete;
+  BoundedQueue& operator=(const BoundedQueue& rhs) = delete;
+
+  // Waits until there is room for the item. Returns false if the queue has been closed.
+  bool Push(T item) {
+    std::unique_lock<std::mutex> lock{m_guard};
+    if (!m_closed && m_items.size() >= m_capacity) {
+      ++m_blocked_pushes;
+      m_not_full.wait(lock, [this]() { return m_closed || m_items.size() < m_capacity; });
+    }
+    if (m_closed) return false;
+
+    Append(std::move(item));
+    return true;
+  }
+
+  // Returns false without waiting if the queue is full or closed.
+  bool TryPush(T item) {
+    std::unique_lock<std::mutex> lock{m_guard};
+    if (m_closed || m_items.size() >= m_capacity) return false;
+
+    Append(std::move(item));
+    return true;
+  }
+
+  // Never waits: if the queue is full, its oldest item is moved to `oldest` to make room and `shed` is set.
+  // Returns false if the queue is closed.
+  bool PushShedOldest(T item, T& oldest, bool& shed) {
+    std::unique_lock<std::mutex> lock{m_guard};
+    shed = false;
+    if (m_closed) return false;
+
+    if (!m_items.empty() && m_items.size() >= m_capacity) {
+      oldest = std::move(m_items.front());
+      m_items.pop_front();
+      shed = true;
+    }
+
+    Append(std::move(item));
+    return true;
+  }
+
+  // Waits for an item. Returns false once the queue has been closed.
+  bool Pop(T& item) {
+    std::unique_lock<std::mutex> lock{m_guard};
+    m_not_empty.wait(lock, [this]() { return m_closed || !m_items.empty(); });
+    if (m_closed) return false;
+
+    item = std::move(m_items.front());
+    m_items.pop_front();
+    m_not_full.notify_one();
+    return true;
+  }
+
+  // Wakes up all the waiting producers and consumers and drops the items still queued.
+  void Close() {
+    std::deque<T> dropped;
+    {
+      std::unique_lock<std::mutex> lock{m_guard};
+      m_closed = true;
+      dropped.swap(m_items);
+    }
+    m_not_empty.notify_all();
+    m_not_full.notify_all();
+  }
+
+  std::size_t Size() const {
+    std::unique_lock<std::mutex> lock{m_guard};
+    return m_items.size();
+  }
+
+  std::size_t Capacity() const { return m_capacity; }
+
+  // Largest number of items queued at once so far.
+  std::size_t MaxSize() const {
+    std::unique_lock<std::mutex> lock{m_guard};
+    return m_max_size;
+  }
+
+  // Number of Push() calls that found the queue full and had to wait.
+  std::uint64_t BlockedPushes() const {
+    std::unique_lock<std::mutex> lock{m_guard};
+    return m_blocked_pushes;
+  }
+
+private:
+  // Called with m_guard held.
+  void Append(T item) {
+    m_items.push_back(std::move(item));
+    if (m_items.size() > m_max_size) m_max_size = m_items.size();
+    m_not_empty.notify_one();
+  }
+
+private:
+  const std::size_t m_capacity;
+  bool m_closed;
+  std::deque<T> m_items;
+  std::size_t m_max_size;
+  std::uint64_t m_blocked_pushes;
+  mutable std::mutex m_guard;
+  std::condition_variable m_not_empty;
+  std::condition_variable m_not_full;
+};
+
+#endif /* BOUNDED_QUEUE_H */
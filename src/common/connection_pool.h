@@ -0,0 +1,165 @@
+#ifndef CONNECTION_POOL_H
+#define CONNECTION_POOL_H
+
+#include <asio.hpp>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Keeps warm TCP connections to remote endpoints so that repeated requests to the same server skip the
+// connection establishment. Idle connections are reused in LIFO order (the most recently used one is the
+// most likely to still be alive) and are health-checked before being handed out. The pool can be used from
+// multiple threads.
+class ConnectionPool {
+public:
+  typedef std::shared_ptr<asio::ip::tcp::socket> SocketPtr;
+
+  struct Config {
+    // Maximum number of idle connections kept per endpoint, extra ones are closed when released.
+    std::size_t max_idle = 8;
+
+    // Maximum number of connections (idle and in use) per endpoint, 0 means unlimited.
+    std::size_t max_total = 64;
+
+    // Idle connections older than this are not reused. Keep it below the server's idle timeout.
+    std::chrono::steady_clock::duration max_idle_time = std::chrono::seconds(25);
+  };
+
+  ConnectionPool(asio::io_service& ios, const Config& config) : m_ios(ios), m_config(config) {}
+  ConnectionPool(const ConnectionPool& src) = delete;
+  ConnectionPool& operator=(const ConnectionPool& rhs) = delete;
+
+  // Returns a connection to the endpoint. `connected` tells whether it is a reused, already connected socket
+  // or a fresh one the caller has to connect. Returns nullptr with `ec` set if the endpoint has reached
+  // max_total connections (no_buffer_space) or a new socket could not be opened. Every acquired socket must
+  // be given back with Release().
+  SocketPtr Acquire(const asio::ip::tcp::endpoint& ep, bool& connected, asio::error_code& ec) {
+    std::vector<SocketPtr> stale;  // Closed outside of the lock.
+    SocketPtr sock;
+
+    {
+      std::unique_lock<std::mutex> lock{m_guard};
+      Connections& conns = m_connections[ep];
+      auto now = std::chrono::steady_clock::now();
+
+      while (!conns.m_idle.empty()) {
+        IdleConnection idle = conns.m_idle.back();
+        conns.m_idle.pop_back();
+
+        if (now - idle.m_since <= m_config.max_idle_time && IsHealthy(*idle.m_sock)) {
+          sock = idle.m_sock;
+          break;
+        }
+
+        --conns.m_total;
+        stale.push_back(idle.m_sock);
+      }
+
+      if (sock) {
+        connected = true;
+        return sock;
+      }
+
+      if (m_config.max_total != 0 && conns.m_total >= m_config.max_total) {
+        ec = asio::error::no_buffer_space;
+        return nullptr;
+      }
+
+      ++conns.m_total;
+    }
+
+    CloseAll(stale);
+
+    connected = false;
+    sock = std::make_shared<asio::ip::tcp::socket>(m_ios);
+    sock->open(ep.protocol(), ec);
+    if (ec) {
+      // The slot was taken for a connection that does not exist.
+      std::unique_lock<std::mutex> lock{m_guard};
+      --m_connections[ep].m_total;
+      return nullptr;
+    }
+    return sock;
+  }
+
+  // Gives back a connection acquired from the pool. A connection is kept for reuse only if `reusable` is set
+  // (the last exchange on it completed cleanly) and the endpoint has room for another idle connection.
+  void Release(const asio::ip::tcp::endpoint& ep, SocketPtr sock, bool reusable) {
+    {
+      std::unique_lock<std::mutex> lock{m_guard};
+      Connections& conns = m_connections[ep];
+
+      if (reusable && sock->is_open() && conns.m_idle.size() < m_config.max_idle) {
+        conns.m_idle.push_back(IdleConnection{sock, std::chrono::steady_clock::now()});
+        return;
+      }
+
+      --conns.m_total;
+    }
+
+    Close(*sock);
+  }
+
+  // Closes all the idle connections.
+  void Clear() {
+    std::vector<SocketPtr> socks;
+    {
+      std::unique_lock<std::mutex> lock{m_guard};
+      for (auto& entry : m_connections) {
+        for (auto& idle : entry.second.m_idle) socks.push_back(idle.m_sock);
+        entry.second.m_total -= entry.second.m_idle.size();
+        entry.second.m_idle.clear();
+      }
+    }
+
+    CloseAll(socks);
+  }
+
+  // An idle connection is healthy if the peer has neither closed it nor sent unsolicited data. The check is
+  // a non-blocking peek that must find nothing to read.
+  static bool IsHealthy(asio::ip::tcp::socket& sock) {
+    if (!sock.is_open()) return false;
+
+    asio::error_code ec;
+    sock.non_blocking(true, ec);
+    if (ec) return false;
+
+    char byte;
+    sock.receive(asio::buffer(&byte, 1), asio::socket_base::message_peek, ec);
+    bool healthy = (ec == asio::error::would_block);
+
+    sock.non_blocking(false, ec);
+    return healthy && !ec;
+  }
+
+private:
+  struct IdleConnection {
+    SocketPtr m_sock;
+    std::chrono::steady_clock::time_point m_since;  // When the connection was released to the pool.
+  };
+
+  struct Connections {
+    std::vector<IdleConnection> m_idle;  // Used as a stack, the back is the most recently released one.
+    std::size_t m_total = 0;             // Idle and in use connections.
+  };
+
+  static void Close(asio::ip::tcp::socket& sock) {
+    asio::error_code ignored_ec;
+    sock.shutdown(asio::ip::tcp::socket::shutdown_both, ignored_ec);
+    sock.close(ignored_ec);
+  }
+
+  static void CloseAll(std::vector<SocketPtr>& socks) {
+    for (auto& sock : socks) Close(*sock);
+  }
+
+private:
+  asio::io_service& m_ios;
+  Config m_config;
+  std::map<asio::ip::tcp::endpoint, Connections> m_connections;
+  std::mutex m_guard;
+};
+
+#endif /* CONNECTION_POOL_H */
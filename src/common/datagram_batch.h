@@ -0,0 +1,194 @@
+#ifndef DATAGRAM_BATCH_H
+#define DATAGRAM_BATCH_H
+
+#include <asio.hpp>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#endif
+
+// A fixed number of datagram slots that are sent or received together with a single system call (sendmmsg
+// and recvmmsg on Linux, one call per datagram elsewhere). All the memory involved (payloads, addresses and
+// message headers) is allocated up front and reused, so moving datagrams through a batch never allocates.
+class DatagramBatch {
+public:
+  DatagramBatch(std::size_t capacity, std::size_t max_datagram_size)
+      : m_max_datagram_size{max_datagram_size},
+        m_data(capacity * max_datagram_size),
+        m_sizes(capacity, 0),
+        m_endpoints(capacity),
+        m_count{0} {
+#ifdef __linux__
+    m_iovecs.resize(capacity);
+    m_headers.resize(capacity);
+#endif
+  }
+  DatagramBatch(const DatagramBatch& src) = delete;
+  DatagramBatch& operator=(const DatagramBatch& rhs) = delete;
+
+  std::size_t Capacity() const { return m_sizes.size(); }
+  std::size_t MaxDatagramSize() const { return m_max_datagram_size; }
+
+  // Number of datagrams added or received.
+  std::size_t Size() const { return m_count; }
+  bool Full() const { return m_count == Capacity(); }
+  void Clear() { m_count = 0; }
+
+  // Appends a datagram to send to `ep`, copying the payload into the batch. Returns false if the batch is
+  // full or the payload does not fit in a slot.
+  bool Add(const asio::ip::udp::endpoint& ep, const void* data, std::size_t size) {
+    if (Full() || size > m_max_datagram_size) return false;
+
+    std::memcpy(Slot(m_count), data, size);
+    m_sizes[m_count] = size;
+    m_endpoints[m_count] = ep;
+    ++m_count;
+    return true;
+  }
+
+  // Appends an empty datagram to send to `ep` and returns its slot, to be filled in place and then sized
+  // with Resize(). Returns nullptr if the batch is full.
+  char* Add(const asio::ip::udp::endpoint& ep) {
+    if (Full()) return nullptr;
+
+    m_sizes[m_count] = 0;
+    m_endpoints[m_count] = ep;
+    return Slot(m_count++);
+  }
+
+  // Sets the size of the datagram in slot `i`, at most MaxDatagramSize().
+  void Resize(std::size_t i, std::size_t size) {
+    m_sizes[i] = size < m_max_datagram_size ? size : m_max_datagram_size;
+  }
+
+  const char* Data(std::size_t i) const { return m_data.data() + i * m_max_datagram_size; }
+  std::size_t Size(std::size_t i) const { return m_sizes[i]; }
+
+  // Sender of a received datagram, or destination of one to send.
+  const asio::ip::udp::endpoint& Endpoint(std::size_t i) const { return m_endpoints[i]; }
+
+private:
+  friend std::size_t SendDatagrams(asio::ip::udp::socket&, DatagramBatch&, asio::error_code&);
+  friend std::size_t ReceiveDatagrams(asio::ip::udp::socket&, DatagramBatch&, asio::error_code&);
+
+  char* Slot(std::size_t i) { return m_data.data() + i * m_max_datagram_size; }
+
+#ifdef __linux__
+  // Points the message header of slot `i` at its payload and address.
+  void PrepareHeader(std::size_t i, std::size_t size, std::size_t address_size) {
+    m_iovecs[i].iov_base = Slot(i);
+    m_iovecs[i].iov_len = size;
+
+    mmsghdr& hdr = m_headers[i];
+    std::memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_hdr.msg_name = m_endpoints[i].data();
+    hdr.msg_hdr.msg_namelen = static_cast<socklen_t>(address_size);
+    hdr.msg_hdr.msg_iov = &m_iovecs[i];
+    hdr.msg_hdr.msg_iovlen = 1;
+  }
+#endif
+
+private:
+  std::size_t m_max_datagram_size;
+  std::vector<char> m_data;  // Slot i starts at offset i * m_max_datagram_size.
+  std::vector<std::size_t> m_sizes;
+  std::vector<asio::ip::udp::endpoint> m_endpoints;
+  std::size_t m_count;
+
+#ifdef __linux__
+  std::vector<iovec> m_iovecs;
+  std::vector<mmsghdr> m_headers;
+#endif
+};
+
+// Sends the datagrams of the batch, as many as possible per system call. Returns the number of datagrams
+// sent: fewer than batch.Size() only if an error occurred (e.g. would_block on a non-blocking socket).
+inline std::size_t SendDatagrams(asio::ip::udp::socket& sock, DatagramBatch& batch, asio::error_code& ec) {
+  ec = asio::error_code{};
+  std::size_t sent = 0;
+
+#ifdef __linux__
+  for (std::size_t i = 0; i < batch.Size(); ++i) {
+    batch.PrepareHeader(i, batch.m_sizes[i], batch.m_endpoints[i].size());
+  }
+
+  while (sent < batch.Size()) {
+    unsigned int count = static_cast<unsigned int>(batch.Size() - sent);
+    int n = ::sendmmsg(sock.native_handle(), &batch.m_headers[sent], count, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      ec = asio::error_code(errno, asio::error::get_system_category());
+      break;
+    }
+    sent += static_cast<std::size_t>(n);
+  }
+#else
+  for (; sent < batch.Size(); ++sent) {
+    sock.send_to(asio::buffer(batch.Data(sent), batch.Size(sent)), batch.Endpoint(sent), 0, ec);
+    if (ec) break;
+  }
+#endif
+
+  return sent;
+}
+
+// Receives up to batch.Capacity() datagrams into the batch, replacing its content. On a blocking socket it
+// waits for the first datagram only and then takes whatever else is already queued. Returns the number of
+// datagrams received, 0 on error (would_block on a non-blocking socket with nothing to read).
+inline std::size_t ReceiveDatagrams(asio::ip::udp::socket& sock, DatagramBatch& batch, asio::error_code& ec) {
+  ec = asio::error_code{};
+  batch.Clear();
+
+#ifdef __linux__
+  for (std::size_t i = 0; i < batch.Capacity(); ++i) {
+    batch.PrepareHeader(i, batch.m_max_datagram_size, batch.m_endpoints[i].capacity());
+  }
+
+  int n;
+  do {
+    unsigned int count = static_cast<unsigned int>(batch.Capacity());
+    n = ::recvmmsg(sock.native_handle(), batch.m_headers.data(), count, MSG_WAITFORONE, nullptr);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0) {
+    ec = asio::error_code(errno, asio::error::get_system_category());
+    return 0;
+  }
+
+  for (int i = 0; i < n; ++i) {
+    batch.m_sizes[i] = batch.m_headers[i].msg_len;
+    batch.m_endpoints[i].resize(batch.m_headers[i].msg_hdr.msg_namelen);
+  }
+  batch.m_count = static_cast<std::size_t>(n);
+#else
+  std::size_t size = sock.receive_from(asio::buffer(batch.Slot(0), batch.m_max_datagram_size),
+                                       batch.m_endpoints[0], 0, ec);
+  if (ec) return 0;
+
+  batch.m_sizes[0] = size;
+  batch.m_count = 1;
+#endif
+
+  return batch.m_count;
+}
+
+// Throwing versions of the above, in the style of the asio functions.
+inline std::size_t SendDatagrams(asio::ip::udp::socket& sock, DatagramBatch& batch) {
+  asio::error_code ec;
+  std::size_t sent = SendDatagrams(sock, batch, ec);
+  if (ec) throw asio::system_error(ec);
+  return sent;
+}
+
+inline std::size_t ReceiveDatagrams(asio::ip::udp::socket& sock, DatagramBatch& batch) {
+  asio::error_code ec;
+  std::size_t received = ReceiveDatagrams(sock, batch, ec);
+  if (ec) throw asio::system_error(ec);
+  return received;
+}
+
+#endif /* DATAGRAM_BATCH_H */
@@ -0,0 +1,253 @@
+#ifndef FRAME_READER_H
+#define FRAME_READER_H
+
+#include "receive_buffer.h"
+#include <algorithm>
+#include <asio.hpp>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Non-owning view of a frame inside a receive buffer. It stays valid until the buffer is written to again.
+struct FrameView {
+  const char* data = nullptr;
+  std::size_t size = 0;
+
+  std::string ToString() const { return std::string(data, size); }
+};
+
+// Returns a pointer to the first occurrence of `delim` in [begin, end), or `end` if there is none. Scans 32
+// or 16 bytes per step with AVX2/SSE2 when the target supports them.
+inline const char* FindDelimiter(const char* begin, const char* end, char delim) {
+#if defined(__AVX2__)
+  const __m256i needle32 = _mm256_set1_epi8(delim);
+  while (end - begin >= 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle32)));
+    if (mask != 0) return begin + __builtin_ctz(mask);
+    begin += 32;
+  }
+#endif
+
+#if defined(__SSE2__)
+  const __m128i needle16 = _mm_set1_epi8(delim);
+  while (end - begin >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle16)));
+    if (mask != 0) return begin + __builtin_ctz(mask);
+    begin += 16;
+  }
+#endif
+
+  const void* found = std::memchr(begin, delim, static_cast<std::size_t>(end - begin));
+  return found != nullptr ? static_cast<const char*>(found) : end;
+}
+
+// Splits a byte stream into delimiter-terminated frames without copying them. Data is received straight into
+// a flat buffer used as a ring: consumed frames free space at the front, and the partial frame left at the
+// end is moved back to the front only when the tail runs out of room, so every frame is contiguous and
+// can be handed out as a FrameView pointing into the buffer. Bytes already scanned are never scanned again.
+// The buffer comes from the per-thread ReceiveBufferCache and is sized after the frames seen so far: it
+// doubles while a frame does not fit, and is swapped for a smaller one once it is empty and much larger than
+// the recent frames need. Release() gives it back while no data is pending, e.g. while the peer is idle.
+class FrameReader {
+public:
+  // The buffer is allocated by the first Prepare(), `initial_capacity` bytes large.
+  explicit FrameReader(std::size_t initial_capacity = 512, std::size_t max_frame_size = 64 * 1024,
+                       char delimiter = '\n')
+      : m_max_frame_size{max_frame_size},
+        m_delimiter{delimiter},
+        m_begin{0},
+        m_end{0},
+        m_scanned{0},
+        m_frame_size{initial_capacity / 2} {}
+
+  // Returns the free space the next receive operation should write into, making room if needed. Returns an
+  // empty buffer if the pending partial frame already exceeds the maximum frame size.
+  asio::mutable_buffers_1 Prepare() {
+    if (m_begin == m_end) {
+      m_begin = m_end = m_scanned = 0;
+      std::size_t target = TargetCapacity();
+      if (m_buf.Capacity() == 0 || m_buf.Capacity() >= 4 * target) m_buf = ReceiveBuffer{target};
+    }
+
+    if (m_end == m_buf.Capacity()) {
+      if (m_begin != 0) {
+        // Move the partial frame to the front of the buffer.
+        std::memmove(m_buf.Data(), m_buf.Data() + m_begin, m_end - m_begin);
+        m_end -= m_begin;
+        m_scanned -= m_begin;
+        m_begin = 0;
+      } else if (m_buf.Capacity() < m_max_frame_size) {
+        ReceiveBuffer larger{std::min(m_buf.Capacity() * 2, m_max_frame_size)};
+        std::memcpy(larger.Data(), m_buf.Data(), m_end);
+        m_buf = std::move(larger);
+      }
+    }
+
+    return asio::buffer(m_buf.Data() + m_end, m_buf.Capacity() - m_end);
+  }
+
+  // Makes `size` bytes written into the buffer returned by Prepare() available for framing.
+  void Commit(std::size_t size) { m_end += size; }
+
+  // Extracts the next complete frame, without its delimiter. Returns false if no complete frame is buffered.
+  // The view stays valid until the next call to Prepare().
+  bool Next(FrameView& frame) {
+    if (m_scanned == m_end) return false;
+
+    const char* base = m_buf.Data();
+    const char* found = FindDelimiter(base + m_scanned, base + m_end, m_delimiter);
+
+    if (found == base + m_end) {
+      m_scanned = m_end;
+      return false;
+    }
+
+    frame.data = base + m_begin;
+    frame.size = static_cast<std::size_t>(found - frame.data);
+
+    // Moving average of the frame sizes, delimiter included.
+    m_frame_size = (m_frame_size * 7 + frame.size + 1) / 8;
+
+    m_begin = static_cast<std::size_t>(found - base) + 1;
+    m_scanned = m_begin;
+    if (m_begin == m_end) m_begin = m_end = m_scanned = 0;
+    return true;
+  }
+
+  // True if a complete frame is buffered. Bytes scanned here are not scanned again by Next().
+  bool HasFrame() {
+    if (m_scanned == m_end) return false;
+
+    const char* base = m_buf.Data();
+    const char* found = FindDelimiter(base + m_scanned, base + m_end, m_delimiter);
+    m_scanned = static_cast<std::size_t>(found - base);
+    return found != base + m_end;
+  }
+
+  // True if the pending partial frame cannot grow any more.
+  bool Full() const {
+    return m_begin == 0 && m_end == m_buf.Capacity() && m_buf.Capacity() >= m_max_frame_size;
+  }
+
+  // Number of buffered bytes not yet returned as frames.
+  std::size_t Pending() const { return m_end - m_begin; }
+
+  // Drops all the buffered data, keeping the buffer.
+  void Clear() { m_begin = m_end = m_scanned = 0; }
+
+  // Gives the buffer back to the cache if no data is pending. The next Prepare() allocates a new one.
+  void Release() {
+    if (Pending() != 0) return;
+
+    Clear();
+    m_buf.Reset();
+  }
+
+private:
+  // Capacity fitting a couple of frames of the average size.
+  std::size_t TargetCapacity() const {
+    std::size_t size = std::min(std::max(2 * m_frame_size, std::size_t{1}), m_max_frame_size);
+    return ReceiveBufferCache::RoundUp(size);
+  }
+
+private:
+  ReceiveBuffer m_buf;
+  std::size_t m_max_frame_size;
+  char m_delimiter;
+  std::size_t m_begin;       // Start of the first frame not yet returned.
+  std::size_t m_end;         // End of the received data.
+  std::size_t m_scanned;     // Everything before this offset is known not to contain the delimiter.
+  std::size_t m_frame_size;  // Moving average of the sizes of the frames returned so far.
+};
+
+// Composed operation reading from a stream until the FrameReader holds a complete frame. The handler is
+// called with the frame, or with an error. Allocation and invocation hooks are forwarded to the user's
+// handler, so custom handler allocation and strands keep working.
+template <typename Stream, typename Handler>
+class ReadFrameOp {
+public:
+  ReadFrameOp(Stream& stream, FrameReader& reader, Handler handler)
+      : m_stream(stream), m_reader(reader), m_handler(std::move(handler)) {}
+
+  void Start() { ReadSome(); }
+
+  void operator()(const asio::error_code& ec, std::size_t bytes_transferred) {
+    if (ec) {
+      m_handler(ec, FrameView{});
+      return;
+    }
+
+    m_reader.Commit(bytes_transferred);
+
+    FrameView frame;
+    if (m_reader.Next(frame)) {
+      m_handler(ec, frame);
+    } else if (m_reader.Full()) {
+      m_handler(asio::error::message_size, FrameView{});
+    } else {
+      ReadSome();
+    }
+  }
+
+  template <typename Function>
+  friend void asio_handler_invoke(Function& function, ReadFrameOp* op) {
+    using asio::asio_handler_invoke;
+    asio_handler_invoke(function, std::addressof(op->m_handler));
+  }
+
+  template <typename Function>
+  friend void asio_handler_invoke(const Function& function, ReadFrameOp* op) {
+    using asio::asio_handler_invoke;
+    asio_handler_invoke(function, std::addressof(op->m_handler));
+  }
+
+  friend void* asio_handler_allocate(std::size_t size, ReadFrameOp* op) {
+    using asio::asio_handler_allocate;
+    return asio_handler_allocate(size, std::addressof(op->m_handler));
+  }
+
+  friend void asio_handler_deallocate(void* pointer, std::size_t size, ReadFrameOp* op) {
+    using asio::asio_handler_deallocate;
+    asio_handler_deallocate(pointer, size, std::addressof(op->m_handler));
+  }
+
+private:
+  void ReadSome() {
+    // When a frame is already buffered (or the buffer is full) an empty read is issued: it completes right
+    // away through the io_service, so the handler is never called from within the initiating function.
+    asio::mutable_buffers_1 buf = m_reader.Prepare();
+    if (m_reader.HasFrame()) buf = asio::mutable_buffers_1(nullptr, 0);
+    m_stream.async_read_some(buf, std::move(*this));
+  }
+
+private:
+  Stream& m_stream;
+  FrameReader& m_reader;
+  Handler m_handler;
+};
+
+// Reads the next frame asynchronously. The handler signature is void(const asio::error_code&, FrameView).
+template <typename Stream, typename Handler>
+inline void AsyncReadFrame(Stream& stream, FrameReader& reader, Handler handler) {
+  ReadFrameOp<Stream, Handler>(stream, reader, std::move(handler)).Start();
+}
+
+// Reads the next frame synchronously, throwing asio::system_error on failure.
+template <typename Stream>
+inline FrameView ReadFrame(Stream& stream, FrameReader& reader) {
+  FrameView frame;
+  while (!reader.Next(frame)) {
+    if (reader.Full()) throw asio::system_error(asio::error::message_size);
+    reader.Commit(stream.read_some(reader.Prepare()));
+  }
+  return frame;
+}
+
+#endif /* FRAME_READER_H */
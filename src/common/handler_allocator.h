@@ -0,0 +1,75 @@
+#ifndef HANDLER_ALLOCATOR_H
+#define HANDLER_ALLOCATOR_H
+
+#include <asio.hpp>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Memory block used to allocate the internal state of asynchronous operations. An object that never has more
+// than one asynchronous operation in flight (e.g. a request session doing connect, write and read one after
+// another) can own one of these and have all its operations allocated from it, avoiding the heap. Requests
+// that do not fit, or arrive while the block is in use, fall back to the global heap. Not thread-safe: the
+// operations sharing a block must not overlap.
+class HandlerMemory {
+public:
+  HandlerMemory() : m_in_use{false} {}
+  HandlerMemory(const HandlerMemory& src) = delete;
+  HandlerMemory& operator=(const HandlerMemory& rhs) = delete;
+
+  void* Allocate(std::size_t size) {
+    if (!m_in_use && size <= sizeof(m_storage)) {
+      m_in_use = true;
+      return &m_storage;
+    }
+
+    return ::operator new(size);
+  }
+
+  void Deallocate(void* pointer) {
+    if (pointer == &m_storage) {
+      m_in_use = false;
+    } else {
+      ::operator delete(pointer);
+    }
+  }
+
+private:
+  typename std::aligned_storage<512>::type m_storage;
+  bool m_in_use;
+};
+
+// Wraps a completion handler so that asio allocates the memory of the operation it completes from the given
+// HandlerMemory, through the asio_handler_allocate/asio_handler_deallocate customization hooks.
+template <typename Handler>
+class CustomAllocHandler {
+public:
+  CustomAllocHandler(HandlerMemory& memory, Handler handler)
+      : m_memory(memory), m_handler(std::move(handler)) {}
+
+  template <typename... Args>
+  void operator()(Args&&... args) {
+    m_handler(std::forward<Args>(args)...);
+  }
+
+  friend void* asio_handler_allocate(std::size_t size, CustomAllocHandler<Handler>* this_handler) {
+    return this_handler->m_memory.Allocate(size);
+  }
+
+  friend void asio_handler_deallocate(void* pointer, std::size_t /* size */,
+                                      CustomAllocHandler<Handler>* this_handler) {
+    this_handler->m_memory.Deallocate(pointer);
+  }
+
+private:
+  HandlerMemory& m_memory;
+  Handler m_handler;
+};
+
+template <typename Handler>
+inline CustomAllocHandler<Handler> MakeCustomAllocHandler(HandlerMemory& memory, Handler handler) {
+  return CustomAllocHandler<Handler>(memory, std::move(handler));
+}
+
+#endif /* HANDLER_ALLOCATOR_H */
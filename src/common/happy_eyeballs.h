@@ -0,0 +1,179 @@
+#ifndef HAPPY_EYEBALLS_H
+#define HAPPY_EYEBALLS_H
+
+#include <asio.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Connects a socket to the first of several endpoints that answers, racing the candidates as described by
+// RFC 8305 ("Happy Eyeballs"):
+// - the endpoints are ordered alternating the address families, starting with the family of the first one
+//   (the resolver already sorts them by preference, so IPv6 usually comes first);
+// - a new attempt starts every `attempt_delay` while the previous ones are still pending, or right away
+//   when an attempt fails;
+// - the first connection established wins, the other attempts are cancelled and their sockets closed.
+// A dead address therefore costs `attempt_delay` instead of a full connect timeout. The handler receives the
+// winning endpoint and the time its connection took, or the error of the last attempt if all of them failed.
+// The socket must stay alive until the handler is called, `Start` requires its io_service.
+class HappyEyeballsConnect : public std::enable_shared_from_this<HappyEyeballsConnect> {
+public:
+  typedef std::function<void(const asio::error_code& ec, const asio::ip::tcp::endpoint& ep,
+                             std::chrono::steady_clock::duration latency)>
+      Handler;
+
+  // The default delay between attempts is the one recommended by RFC 8305, section 8.
+  static void Start(asio::io_service& ios, asio::ip::tcp::socket& sock,
+                    const std::vector<asio::ip::tcp::endpoint>& endpoints, Handler handler,
+                    std::chrono::steady_clock::duration attempt_delay = std::chrono::milliseconds(250)) {
+    std::shared_ptr<HappyEyeballsConnect> op{
+        new HappyEyeballsConnect(ios, sock, Interleave(endpoints), std::move(handler), attempt_delay)};
+    op->m_strand.dispatch([op]() { op->StartAttempt(); });
+  }
+
+  // Orders the endpoints alternating the address families, keeping the relative order within each family.
+  static std::vector<asio::ip::tcp::endpoint> Interleave(
+      const std::vector<asio::ip::tcp::endpoint>& endpoints) {
+    if (endpoints.empty()) return endpoints;
+
+    std::vector<asio::ip::tcp::endpoint> preferred, other;
+    for (const auto& ep : endpoints) {
+      if (ep.protocol() == endpoints.front().protocol()) {
+        preferred.push_back(ep);
+      } else {
+        other.push_back(ep);
+      }
+    }
+
+    std::vector<asio::ip::tcp::endpoint> ordered;
+    ordered.reserve(endpoints.size());
+    for (std::size_t i = 0; i < preferred.size() || i < other.size(); ++i) {
+      if (i < preferred.size()) ordered.push_back(preferred[i]);
+      if (i < other.size()) ordered.push_back(other[i]);
+    }
+    return ordered;
+  }
+
+private:
+  struct Attempt {
+    explicit Attempt(asio::io_service& ios) : m_sock{ios} {}
+
+    asio::ip::tcp::socket m_sock;
+    std::chrono::steady_clock::time_point m_started;
+  };
+
+  HappyEyeballsConnect(asio::io_service& ios, asio::ip::tcp::socket& sock,
+                       std::vector<asio::ip::tcp::endpoint> endpoints, Handler handler,
+                       std::chrono::steady_clock::duration attempt_delay)
+      : m_ios(ios),
+        m_sock(sock),
+        m_strand{ios},
+        m_timer{ios},
+        m_endpoints{std::move(endpoints)},
+        m_handler{std::move(handler)},
+        m_attempt_delay{attempt_delay},
+        m_next{0},
+        m_pending{0},
+        m_timer_generation{0},
+        m_done{false},
+        m_last_ec{asio::error::host_not_found} {}
+
+  // Starts the next attempt and arms the timer starting the one after it. Runs in the strand.
+  void StartAttempt() {
+    while (m_next < m_endpoints.size()) {
+      std::size_t index = m_next++;
+      m_attempts.emplace_back(new Attempt(m_ios));
+      Attempt& attempt = *m_attempts.back();
+
+      // An endpoint whose address family is not available locally fails right away, try the next one.
+      asio::error_code ec;
+      attempt.m_sock.open(m_endpoints[index].protocol(), ec);
+      if (ec) {
+        m_last_ec = ec;
+        continue;
+      }
+
+      attempt.m_started = std::chrono::steady_clock::now();
+      ++m_pending;
+
+      auto self = shared_from_this();
+      attempt.m_sock.async_connect(m_endpoints[index],
+                                   m_strand.wrap([self, index](const asio::error_code& connect_ec) {
+                                     self->onAttemptCompleted(index, connect_ec);
+                                   }));
+
+      if (m_next < m_endpoints.size()) ArmTimer();
+      return;
+    }
+
+    if (m_pending == 0) Complete(m_last_ec, asio::ip::tcp::endpoint{}, {});
+  }
+
+  void ArmTimer() {
+    // A wait that already fired cannot be cancelled any more, the generation tells it is stale.
+    std::size_t generation = ++m_timer_generation;
+
+    auto self = shared_from_this();
+    m_timer.expires_from_now(m_attempt_delay);
+    m_timer.async_wait(m_strand.wrap([self, generation](const asio::error_code& ec) {
+      if (ec == asio::error::operation_aborted || self->m_done || generation != self->m_timer_generation) {
+        return;
+      }
+      self->StartAttempt();
+    }));
+  }
+
+  void onAttemptCompleted(std::size_t index, const asio::error_code& ec) {
+    --m_pending;
+    if (m_done) return;
+
+    Attempt& attempt = *m_attempts[index];
+    if (ec.value() != 0) {
+      attempt.m_sock.close();
+      m_last_ec = ec;
+
+      // Do not wait for the timer, the next candidate starts now.
+      ++m_timer_generation;
+      m_timer.cancel();
+      StartAttempt();
+      return;
+    }
+
+    auto latency = std::chrono::steady_clock::now() - attempt.m_started;
+    m_sock = std::move(attempt.m_sock);
+    Complete(ec, m_endpoints[index], latency);
+  }
+
+  // Reports the result and cancels the attempts still pending.
+  void Complete(const asio::error_code& ec, const asio::ip::tcp::endpoint& ep,
+                std::chrono::steady_clock::duration latency) {
+    m_done = true;
+    m_timer.cancel();
+    for (auto& attempt : m_attempts) {
+      asio::error_code ignored;
+      attempt->m_sock.close(ignored);
+    }
+
+    m_handler(ec, ep, latency);
+  }
+
+private:
+  asio::io_service& m_ios;
+  asio::ip::tcp::socket& m_sock;  // Receives the winning connection.
+  asio::io_service::strand m_strand;
+  asio::steady_timer m_timer;  // Starts the next attempt.
+
+  std::vector<asio::ip::tcp::endpoint> m_endpoints;  // Candidates, in the order they are tried.
+  std::vector<std::unique_ptr<Attempt>> m_attempts;  // One per candidate tried so far.
+  Handler m_handler;
+  std::chrono::steady_clock::duration m_attempt_delay;
+
+  std::size_t m_next;              // Next candidate to try.
+  std::size_t m_pending;           // Attempts in flight.
+  std::size_t m_timer_generation;  // Identifies the current timer wait.
+  bool m_done;
+  asio::error_code m_last_ec;  // Error of the last failed attempt.
+};
+
+#endif /* HAPPY_EYEBALLS_H */
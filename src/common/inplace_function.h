@@ -0,0 +1,109 @@
+#ifndef INPLACE_FUNCTION_H
+#define INPLACE_FUNCTION_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <typename Signature, std::size_t Capacity = 4 * sizeof(void*)>
+class InplaceFunction;
+
+// Move-only replacement for std::function that never allocates: the callable is stored in a buffer of
+// `Capacity` bytes inside the object, and one that does not fit is rejected at compile time instead of being
+// put on the heap. A lambda capturing a few pointers or a shared_ptr fits the default capacity. The callable
+// must be nothrow move-constructible, so that moving an InplaceFunction cannot fail.
+template <typename R, typename... Args, std::size_t Capacity>
+class InplaceFunction<R(Args...), Capacity> {
+public:
+  InplaceFunction() noexcept : m_ops{nullptr} {}
+  InplaceFunction(std::nullptr_t) noexcept : m_ops{nullptr} {}
+
+  template <typename F, typename Callable = typename std::decay<F>::type,
+            typename = typename std::enable_if<!std::is_same<Callable, InplaceFunction>::value>::type>
+  InplaceFunction(F&& f) : m_ops{&OpsFor<Callable>::ops} {
+    static_assert(sizeof(Callable) <= Capacity, "The callable does not fit the capacity of InplaceFunction");
+    static_assert(alignof(Callable) <= alignof(Storage), "The callable is over-aligned for InplaceFunction");
+    static_assert(std::is_nothrow_move_constructible<Callable>::value,
+                  "The callable of an InplaceFunction must be nothrow move-constructible");
+    ::new (static_cast<void*>(&m_storage)) Callable(std::forward<F>(f));
+  }
+
+  InplaceFunction(InplaceFunction&& src) noexcept : m_ops{src.m_ops} {
+    if (m_ops != nullptr) {
+      m_ops->move(&m_storage, &src.m_storage);
+      src.m_ops = nullptr;
+    }
+  }
+
+  InplaceFunction& operator=(InplaceFunction&& rhs) noexcept {
+    if (this != &rhs) {
+      Reset();
+      if (rhs.m_ops != nullptr) {
+        rhs.m_ops->move(&m_storage, &rhs.m_storage);
+        m_ops = rhs.m_ops;
+        rhs.m_ops = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  InplaceFunction& operator=(std::nullptr_t) noexcept {
+    Reset();
+    return *this;
+  }
+
+  InplaceFunction(const InplaceFunction& src) = delete;
+  InplaceFunction& operator=(const InplaceFunction& rhs) = delete;
+
+  ~InplaceFunction() { Reset(); }
+
+  explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+  // Calls the callable. The function must not be empty.
+  R operator()(Args... args) { return m_ops->invoke(&m_storage, std::forward<Args>(args)...); }
+
+private:
+  typedef typename std::aligned_storage<Capacity>::type Storage;
+
+  // What the function needs to know about the type of the callable it holds.
+  struct Ops {
+    R (*invoke)(void* callable, Args&&... args);
+    void (*move)(void* dst, void* src);  // Move-constructs at dst and destroys src.
+    void (*destroy)(void* callable);
+  };
+
+  template <typename Callable>
+  struct OpsFor {
+    static R Invoke(void* callable, Args&&... args) {
+      return (*static_cast<Callable*>(callable))(std::forward<Args>(args)...);
+    }
+
+    static void Move(void* dst, void* src) {
+      ::new (dst) Callable(std::move(*static_cast<Callable*>(src)));
+      static_cast<Callable*>(src)->~Callable();
+    }
+
+    static void Destroy(void* callable) { static_cast<Callable*>(callable)->~Callable(); }
+
+    static const Ops ops;
+  };
+
+  void Reset() noexcept {
+    if (m_ops != nullptr) {
+      m_ops->destroy(&m_storage);
+      m_ops = nullptr;
+    }
+  }
+
+private:
+  const Ops* m_ops;  // Null when the function is empty.
+  Storage m_storage;
+};
+
+template <typename R, typename... Args, std::size_t Capacity>
+template <typename Callable>
+const typename InplaceFunction<R(Args...), Capacity>::Ops
+    InplaceFunction<R(Args...), Capacity>::OpsFor<Callable>::ops = {&Invoke, &Move, &Destroy};
+
+#endif /* INPLACE_FUNCTION_H */
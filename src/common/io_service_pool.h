@@ -0,0 +1,144 @@
+#ifndef IO_SERVICE_POOL_H
+#define IO_SERVICE_POOL_H
+
+#include <asio.hpp>
+#include <atomic>
+#include <cassert>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// A pool of io_service objects (shards). Every shard has its own reactor and its own set of threads, so the
+// completion handlers of one shard never contend with the ones of another. With one thread per shard and
+// pinning enabled this is the classic io_service-per-core design.
+class IoServicePool {
+public:
+  // How new connections are spread across the shards.
+  enum class Dispatch { RoundRobin, LeastLoaded };
+
+  IoServicePool(unsigned int num_of_shards, unsigned int threads_per_shard, bool pin_threads,
+                Dispatch dispatch)
+      : m_threads_per_shard{threads_per_shard}, m_pin_threads{pin_threads}, m_dispatch{dispatch}, m_next{0} {
+    assert(num_of_shards > 0 && threads_per_shard > 0);
+
+    for (unsigned int i = 0; i < num_of_shards; ++i) {
+      std::unique_ptr<Shard> shard{new Shard};
+      shard->m_work.reset(new asio::io_service::work{*shard->m_ios});
+      m_shards.push_back(std::move(shard));
+    }
+  }
+  ~IoServicePool() {
+    // Destroy the io_services first: handlers still queued in them may own connections whose destructors
+    // call Release(), so the shards must outlive them.
+    for (auto& shard : m_shards) {
+      shard->m_work.reset(nullptr);
+      shard->m_ios.reset(nullptr);
+    }
+  }
+  IoServicePool(const IoServicePool& src) = delete;
+  IoServicePool& operator=(const IoServicePool& rhs) = delete;
+
+  // Spawn the threads running the event loops of the shards.
+  void Start() {
+    unsigned int num_of_cpus = std::thread::hardware_concurrency();
+
+    for (std::size_t i = 0; i < m_shards.size(); ++i) {
+      for (unsigned int j = 0; j < m_threads_per_shard; ++j) {
+        asio::io_service& ios = *m_shards[i]->m_ios;
+        std::unique_ptr<std::thread> th{new std::thread{[&ios]() { ios.run(); }}};
+
+        if (m_pin_threads && num_of_cpus > 0) {
+          PinThread(*th, m_threads.size() % num_of_cpus);
+        }
+
+        m_threads.push_back(std::move(th));
+      }
+    }
+  }
+
+  // Stop all the event loops and wait for the threads to exit.
+  void Stop() {
+    for (auto& shard : m_shards) {
+      shard->m_work.reset(nullptr);
+      shard->m_ios->stop();
+    }
+
+    for (auto& th : m_threads) {
+      th->join();
+    }
+  }
+
+  std::size_t Size() const { return m_shards.size(); }
+
+  // True if every shard is run by a single thread: the handlers of a shard then never run concurrently.
+  bool SingleThreadedShards() const { return m_threads_per_shard == 1; }
+
+  asio::io_service& GetIoService(std::size_t shard) { return *m_shards[shard]->m_ios; }
+
+  // Pick the shard a new connection is going to live on and account for it. Every call must be paired with
+  // a call to Release() once the connection is closed.
+  std::size_t Acquire() {
+    std::size_t shard = 0;
+
+    if (m_dispatch == Dispatch::RoundRobin) {
+      shard = m_next.fetch_add(1, std::memory_order_relaxed) % m_shards.size();
+    } else {
+      unsigned int min_load = std::numeric_limits<unsigned int>::max();
+      for (std::size_t i = 0; i < m_shards.size(); ++i) {
+        unsigned int load = m_shards[i]->m_load.load(std::memory_order_relaxed);
+        if (load < min_load) {
+          min_load = load;
+          shard = i;
+        }
+      }
+    }
+
+    m_shards[shard]->m_load.fetch_add(1, std::memory_order_relaxed);
+    return shard;
+  }
+
+  // Account a new connection on the given shard, bypassing the dispatch policy.
+  std::size_t Acquire(std::size_t shard) {
+    m_shards[shard]->m_load.fetch_add(1, std::memory_order_relaxed);
+    return shard;
+  }
+
+  void Release(std::size_t shard) { m_shards[shard]->m_load.fetch_sub(1, std::memory_order_relaxed); }
+
+private:
+  struct Shard {
+    Shard() : m_ios{new asio::io_service}, m_load{0} {}
+
+    std::unique_ptr<asio::io_service> m_ios;
+    std::unique_ptr<asio::io_service::work> m_work;
+    std::atomic<unsigned int> m_load;  // Number of connections currently served by this shard.
+  };
+
+  static void PinThread(std::thread& th, std::size_t cpu) {
+#ifdef __linux__
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    pthread_setaffinity_np(th.native_handle(), sizeof(cpu_set_t), &cpuset);
+#else
+    (void)th;
+    (void)cpu;
+#endif
+  }
+
+private:
+  std::vector<std::unique_ptr<Shard>> m_shards;
+  std::vector<std::unique_ptr<std::thread>> m_threads;
+  unsigned int m_threads_per_shard;
+  bool m_pin_threads;
+  Dispatch m_dispatch;
+  std::atomic<std::size_t> m_next;
+};
+
+#endif /* IO_SERVICE_POOL_H */
@@ -0,0 +1,108 @@
+#ifndef MESSAGE_BUILDER_H
+#define MESSAGE_BUILDER_H
+
+#include <array>
+#include <asio.hpp>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// Collects the parts of a composite message (e.g. a response header, slices of a cached body and a trailer)
+// as a sequence of buffers referencing memory owned elsewhere. The sequence is handed to asio::write or
+// asio::async_write as a single gather operation (writev), so the parts are never concatenated into a
+// contiguous copy. The referenced memory must stay valid until the write completes. Small parts without a
+// stable home (e.g. formatted numbers) can be copied into the builder's own scratch space.
+// The parts are kept in a fixed array of MAX_BUFFERS entries, the most a single writev gathers, so building a
+// message never allocates.
+class MessageBuilder {
+public:
+  static const std::size_t MAX_BUFFERS = 64;
+
+  // Buffer sequence referencing the parts of the builder. It is what asio copies into the write operation,
+  // so it is two pointers rather than a copy of the parts.
+  class BufferSequence {
+  public:
+    typedef asio::const_buffer value_type;
+    typedef const asio::const_buffer* const_iterator;
+
+    BufferSequence(const_iterator begin, const_iterator end) : m_begin{begin}, m_end{end} {}
+
+    const_iterator begin() const { return m_begin; }
+    const_iterator end() const { return m_end; }
+
+  private:
+    const_iterator m_begin;
+    const_iterator m_end;
+  };
+
+  MessageBuilder() : m_count{0}, m_size{0}, m_scratch_used{0} {}
+  MessageBuilder(const MessageBuilder& src) = delete;  // Buffers may point into m_scratch.
+  MessageBuilder& operator=(const MessageBuilder& rhs) = delete;
+
+  MessageBuilder& Append(const void* data, std::size_t size) {
+    if (size != 0) {
+      if (m_count == MAX_BUFFERS) throw std::length_error("MessageBuilder buffers exhausted");
+
+      m_buffers[m_count++] = asio::buffer(data, size);
+      m_size += size;
+    }
+    return *this;
+  }
+
+  MessageBuilder& Append(const std::string& str) { return Append(str.data(), str.size()); }
+
+  MessageBuilder& Append(asio::const_buffer buf) {
+    return Append(asio::buffer_cast<const void*>(buf), asio::buffer_size(buf));
+  }
+
+  // String literals are referenced without their terminating null character.
+  template <std::size_t N>
+  MessageBuilder& Append(const char (&literal)[N]) {
+    return Append(literal, N - 1);
+  }
+
+  // Copies a small part into the scratch space of the builder.
+  MessageBuilder& AppendCopy(const char* data, std::size_t size) {
+    if (size > sizeof(m_scratch) - m_scratch_used) {
+      throw std::length_error("MessageBuilder scratch space exhausted");
+    }
+
+    char* dst = m_scratch + m_scratch_used;
+    std::memcpy(dst, data, size);
+    m_scratch_used += size;
+    return Append(dst, size);
+  }
+
+  MessageBuilder& AppendNumber(unsigned long long value) {
+    char digits[24];
+    int len = std::snprintf(digits, sizeof(digits), "%llu", value);
+    return AppendCopy(digits, static_cast<std::size_t>(len));
+  }
+
+  // The buffer sequence to pass to the write operation. It references the builder, which must not change
+  // until the write completes.
+  BufferSequence Buffers() const { return BufferSequence{m_buffers.data(), m_buffers.data() + m_count}; }
+
+  std::size_t Size() const { return m_size; }
+  bool Empty() const { return m_count == 0; }
+
+  // Number of parts that can still be appended.
+  std::size_t Available() const { return MAX_BUFFERS - m_count; }
+
+  // Forgets all the parts.
+  void Clear() {
+    m_count = 0;
+    m_size = 0;
+    m_scratch_used = 0;
+  }
+
+private:
+  std::array<asio::const_buffer, MAX_BUFFERS> m_buffers;
+  std::size_t m_count;  // Number of parts in m_buffers.
+  std::size_t m_size;   // Total number of bytes referenced by m_buffers.
+  char m_scratch[64];
+  std::size_t m_scratch_used;
+};
+
+#endif /* MESSAGE_BUILDER_H */
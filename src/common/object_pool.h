@@ -0,0 +1,51 @@
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Recycles objects managed by shared_ptr. Released objects (together with their control block) are kept on a
+// free list and handed out again by Acquire(), so in steady state no allocation takes place. The caller is
+// responsible for resetting the state of a recycled object. The pool can be used from multiple threads.
+template <typename T>
+class ObjectPool {
+public:
+  typedef std::function<std::shared_ptr<T>()> Factory;
+
+  ObjectPool(Factory factory, std::size_t max_free) : m_factory{std::move(factory)}, m_max_free{max_free} {
+    m_free.reserve(max_free);
+  }
+  ObjectPool(const ObjectPool& src) = delete;
+  ObjectPool& operator=(const ObjectPool& rhs) = delete;
+
+  std::shared_ptr<T> Acquire() {
+    {
+      std::unique_lock<std::mutex> lock{m_guard};
+      if (!m_free.empty()) {
+        std::shared_ptr<T> obj = std::move(m_free.back());
+        m_free.pop_back();
+        return obj;
+      }
+    }
+
+    return m_factory();
+  }
+
+  // Gives an object back to the pool. Other references to it may still exist, but they must not be used to
+  // access the object anymore.
+  void Recycle(std::shared_ptr<T> obj) {
+    std::unique_lock<std::mutex> lock{m_guard};
+    if (m_free.size() < m_max_free) m_free.push_back(std::move(obj));
+  }
+
+private:
+  Factory m_factory;
+  std::size_t m_max_free;
+  std::vector<std::shared_ptr<T>> m_free;
+  std::mutex m_guard;
+};
+
+#endif /* OBJECT_POOL_H */
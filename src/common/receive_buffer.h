@@ -0,0 +1,149 @@
+#ifndef RECEIVE_BUFFER_H
+#define RECEIVE_BUFFER_H
+
+#include <cstddef>
+#include <new>
+
+// Per-thread cache of receive buffers. Buffers come in power-of-two size classes from MIN_SIZE to MAX_SIZE,
+// and the freed ones are kept on one free list per class instead of being returned to the heap, so a busy
+// connection growing and shrinking its buffer does not go through malloc. A buffer may be freed by another
+// thread than the one that allocated it, it then joins the free list of the freeing thread. Every list is
+// capped at MAX_FREE_BYTES per class, buffers beyond that (and those larger than MAX_SIZE) go to the heap.
+class ReceiveBufferCache {
+public:
+  static const std::size_t MIN_SIZE = 256;
+  static const std::size_t MAX_SIZE = 64 * 1024;
+  static const std::size_t MAX_FREE_BYTES = 256 * 1024;
+
+  // Returns the capacity of the buffer Allocate() hands out for a request of `size` bytes.
+  static std::size_t RoundUp(std::size_t size) {
+    if (size > MAX_SIZE) return size;
+
+    std::size_t capacity = MIN_SIZE;
+    while (capacity < size) capacity *= 2;
+    return capacity;
+  }
+
+  // Allocates a buffer of RoundUp(size) bytes.
+  static char* Allocate(std::size_t size) {
+    std::size_t capacity = RoundUp(size);
+    ReceiveBufferCache* cache = ForThisThread();
+    if (cache != nullptr && capacity <= MAX_SIZE) {
+      FreeList& list = cache->m_lists[ClassOf(capacity)];
+      if (list.m_head != nullptr) {
+        Block* block = list.m_head;
+        list.m_head = block->m_next;
+        --list.m_count;
+        return reinterpret_cast<char*>(block);
+      }
+    }
+
+    return static_cast<char*>(::operator new(capacity));
+  }
+
+  // Frees a buffer returned by Allocate(); `capacity` is its RoundUp() size.
+  static void Deallocate(char* data, std::size_t capacity) {
+    ReceiveBufferCache* cache = ForThisThread();
+    if (cache != nullptr && capacity <= MAX_SIZE) {
+      FreeList& list = cache->m_lists[ClassOf(capacity)];
+      if (list.m_count < MAX_FREE_BYTES / capacity) {
+        Block* block = reinterpret_cast<Block*>(data);
+        block->m_next = list.m_head;
+        list.m_head = block;
+        ++list.m_count;
+        return;
+      }
+    }
+
+    ::operator delete(data);
+  }
+
+private:
+  static const std::size_t NUM_CLASSES = 9;  // MIN_SIZE << 0 to MIN_SIZE << 8.
+
+  struct Block {
+    Block* m_next;
+  };
+
+  struct FreeList {
+    Block* m_head = nullptr;
+    std::size_t m_count = 0;
+  };
+
+  ReceiveBufferCache() = default;
+  ~ReceiveBufferCache() {
+    Exited() = true;
+    for (FreeList& list : m_lists) {
+      while (list.m_head != nullptr) {
+        Block* next = list.m_head->m_next;
+        ::operator delete(list.m_head);
+        list.m_head = next;
+      }
+    }
+  }
+  ReceiveBufferCache(const ReceiveBufferCache& src) = delete;
+  ReceiveBufferCache& operator=(const ReceiveBufferCache& rhs) = delete;
+
+  static std::size_t ClassOf(std::size_t capacity) {
+    std::size_t index = 0;
+    while ((MIN_SIZE << index) < capacity) ++index;
+    return index;
+  }
+
+  // Returns the cache of the calling thread, or null once the thread is tearing down its thread-local
+  // objects (buffers freed by then go straight to the heap).
+  static ReceiveBufferCache* ForThisThread() {
+    if (Exited()) return nullptr;
+    thread_local ReceiveBufferCache cache;
+    return &cache;
+  }
+
+  static bool& Exited() {
+    thread_local bool exited = false;
+    return exited;
+  }
+
+private:
+  FreeList m_lists[NUM_CLASSES];
+};
+
+// Owning handle to a buffer of the ReceiveBufferCache. An empty buffer holds no memory.
+class ReceiveBuffer {
+public:
+  ReceiveBuffer() : m_data{nullptr}, m_capacity{0} {}
+  explicit ReceiveBuffer(std::size_t size)
+      : m_data{ReceiveBufferCache::Allocate(size)}, m_capacity{ReceiveBufferCache::RoundUp(size)} {}
+  ReceiveBuffer(ReceiveBuffer&& src) noexcept : m_data{src.m_data}, m_capacity{src.m_capacity} {
+    src.m_data = nullptr;
+    src.m_capacity = 0;
+  }
+  ReceiveBuffer& operator=(ReceiveBuffer&& rhs) noexcept {
+    if (this != &rhs) {
+      Reset();
+      m_data = rhs.m_data;
+      m_capacity = rhs.m_capacity;
+      rhs.m_data = nullptr;
+      rhs.m_capacity = 0;
+    }
+    return *this;
+  }
+  ReceiveBuffer(const ReceiveBuffer& src) = delete;
+  ReceiveBuffer& operator=(const ReceiveBuffer& rhs) = delete;
+  ~ReceiveBuffer() { Reset(); }
+
+  char* Data() const { return m_data; }
+  std::size_t Capacity() const { return m_capacity; }
+
+  // Gives the memory back to the cache of the calling thread.
+  void Reset() {
+    if (m_data != nullptr) ReceiveBufferCache::Deallocate(m_data, m_capacity);
+    m_data = nullptr;
+    m_capacity = 0;
+  }
+
+private:
+  char* m_data;
+  std::size_t m_capacity;
+};
+
+#endif /* RECEIVE_BUFFER_H */
@@ -0,0 +1,97 @@
+#ifndef RECYCLING_ALLOCATOR_H
+#define RECYCLING_ALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+
+// Keeps freed single-object blocks for reuse instead of returning them to the heap. Only blocks of one size
+// (the first one recycled) are kept, which is what node based containers allocate in steady state. Not
+// thread-safe: it must be protected by the same lock as the container using it.
+class BlockFreeList {
+public:
+  BlockFreeList() : m_head{nullptr}, m_block_size{0} {}
+  ~BlockFreeList() {
+    while (m_head != nullptr) {
+      Block* next = m_head->m_next;
+      ::operator delete(m_head);
+      m_head = next;
+    }
+  }
+  BlockFreeList(const BlockFreeList& src) = delete;
+  BlockFreeList& operator=(const BlockFreeList& rhs) = delete;
+
+  void* Allocate(std::size_t size) {
+    if (m_head != nullptr && size == m_block_size) {
+      Block* block = m_head;
+      m_head = block->m_next;
+      return block;
+    }
+
+    return ::operator new(size);
+  }
+
+  void Deallocate(void* pointer, std::size_t size) {
+    if (m_block_size == 0 && size >= sizeof(Block)) m_block_size = size;
+
+    if (size != m_block_size) {
+      ::operator delete(pointer);
+      return;
+    }
+
+    Block* block = static_cast<Block*>(pointer);
+    block->m_next = m_head;
+    m_head = block;
+  }
+
+private:
+  struct Block {
+    Block* m_next;
+  };
+
+  Block* m_head;
+  std::size_t m_block_size;
+};
+
+// Standard allocator recycling single-object allocations through a BlockFreeList. Array allocations (e.g.
+// the bucket array of an unordered_map) go straight to the heap.
+template <typename T>
+class RecyclingAllocator {
+public:
+  typedef T value_type;
+
+  explicit RecyclingAllocator(BlockFreeList& free_list) : m_free_list{&free_list} {}
+
+  template <typename U>
+  RecyclingAllocator(const RecyclingAllocator<U>& other) : m_free_list{other.m_free_list} {}
+
+  T* allocate(std::size_t n) {
+    if (n == 1) return static_cast<T*>(m_free_list->Allocate(sizeof(T)));
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* pointer, std::size_t n) {
+    if (n == 1) {
+      m_free_list->Deallocate(pointer, sizeof(T));
+    } else {
+      ::operator delete(pointer);
+    }
+  }
+
+  template <typename U>
+  bool operator==(const RecyclingAllocator<U>& other) const {
+    return m_free_list == other.m_free_list;
+  }
+
+  template <typename U>
+  bool operator!=(const RecyclingAllocator<U>& other) const {
+    return m_free_list != other.m_free_list;
+  }
+
+private:
+  template <typename U>
+  friend class RecyclingAllocator;
+
+  BlockFreeList* m_free_list;
+};
+
+#endif /* RECYCLING_ALLOCATOR_H */
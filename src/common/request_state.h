@@ -0,0 +1,101 @@
+#ifndef REQUEST_STATE_H
+#define REQUEST_STATE_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Lifecycle of a client request, shared between the thread completing its I/O operations and the threads
+// that may cancel it, without any lock. A request goes through Idle, Connecting, Writing and Reading to
+// Done, or from any of these steps through Cancelling and Cancelled to Done.
+// The I/O path moves the request from one step to the next with Advance(), which fails once the request has
+// been cancelled. A canceller wins the request with BeginCancel() while it is at any step, aborts its
+// operation (e.g. cancels the socket) and then calls EndCancel(). Finish() ends the request: it waits for a
+// cancellation in progress to be over, so the canceller never touches a request that has already completed
+// (and whose resources may have been recycled).
+// The state is reused by the following requests of a session. Each request gets a new generation number, so
+// that a canceller holding on to an earlier request (e.g. an expired timer) cannot cancel a later one.
+class RequestState {
+public:
+  enum State : std::uint8_t { Idle, Connecting, Writing, Reading, Cancelling, Cancelled, Done };
+
+  RequestState() : m_value{Idle} {}
+  RequestState(const RequestState& src) = delete;
+  RequestState& operator=(const RequestState& rhs) = delete;
+
+  // Prepares the state for a new request and returns its generation. The previous request must be done.
+  std::uint32_t Reset() {
+    std::uint32_t generation = Generation(m_value.load(std::memory_order_relaxed)) + 1;
+    m_value.store(Pack(generation, Idle), std::memory_order_release);
+    return Generation(Pack(generation, Idle));
+  }
+
+  State Get() const { return StateOf(m_value.load(std::memory_order_acquire)); }
+  std::uint32_t Generation() const { return Generation(m_value.load(std::memory_order_acquire)); }
+
+  // Moves the request to its next step. Returns false if it is not at step `from` any more, i.e. it has been
+  // cancelled.
+  bool Advance(State from, State to) {
+    std::uint32_t value = m_value.load(std::memory_order_relaxed);
+    if (StateOf(value) != from) return false;
+    return m_value.compare_exchange_strong(value, Pack(Generation(value), to), std::memory_order_acq_rel,
+                                           std::memory_order_relaxed);
+  }
+
+  // Takes the request over for cancellation. Returns false if it is already done or being cancelled.
+  bool BeginCancel() { return BeginCancel(false, 0); }
+
+  // Same as above, but only if the current request is of the given generation.
+  bool BeginCancel(std::uint32_t generation) { return BeginCancel(true, generation); }
+
+  // Marks the cancellation started with BeginCancel() as complete. Writes made by the canceller before this
+  // call are visible to the thread calling Finish().
+  void EndCancel() {
+    std::uint32_t value = m_value.load(std::memory_order_relaxed);
+    m_value.store(Pack(Generation(value), Cancelled), std::memory_order_release);
+  }
+
+  // Ends the request. Returns true if it was cancelled.
+  bool Finish() {
+    std::uint32_t value = m_value.load(std::memory_order_acquire);
+    for (;;) {
+      if (StateOf(value) == Cancelling) {
+        // The canceller is in the middle of aborting the operation, it is only a matter of a system call.
+        std::this_thread::yield();
+        value = m_value.load(std::memory_order_acquire);
+        continue;
+      }
+
+      if (m_value.compare_exchange_weak(value, Pack(Generation(value), Done), std::memory_order_acq_rel,
+                                        std::memory_order_acquire)) {
+        return StateOf(value) == Cancelled;
+      }
+    }
+  }
+
+private:
+  // The state is kept in the low byte of the value, the generation in the rest of it.
+  static const unsigned int STATE_BITS = 8;
+
+  static std::uint32_t Pack(std::uint32_t generation, State state) {
+    return (generation << STATE_BITS) | state;
+  }
+  static State StateOf(std::uint32_t value) { return static_cast<State>(value & ((1u << STATE_BITS) - 1)); }
+  static std::uint32_t Generation(std::uint32_t value) { return value >> STATE_BITS; }
+
+  bool BeginCancel(bool check_generation, std::uint32_t generation) {
+    std::uint32_t value = m_value.load(std::memory_order_acquire);
+    while (StateOf(value) < Cancelling && (!check_generation || Generation(value) == generation)) {
+      if (m_value.compare_exchange_weak(value, Pack(Generation(value), Cancelling), std::memory_order_acq_rel,
+                                        std::memory_order_acquire)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  std::atomic<std::uint32_t> m_value;
+};
+
+#endif /* REQUEST_STATE_H */
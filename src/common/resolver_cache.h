@@ -0,0 +1,191 @@
+#ifndef RESOLVER_CACHE_H
+#define RESOLVER_CACHE_H
+
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Asynchronous DNS resolver keeping the results of its lookups for a while:
+// - a name that is already cached is answered without any query;
+// - callers asking for a name whose lookup is in flight wait for that lookup instead of starting their own;
+// - failed lookups are cached too (for a shorter time), so a bad name does not hit the DNS on every call;
+// - a name asked for shortly before its entry expires is refreshed in the background, the callers keep
+//   getting the cached result meanwhile and never wait for the refresh.
+// The system resolver does not report the TTL of the records, the time results are kept is configured. The
+// cache can be used from multiple threads; handlers are always executed through the io_service.
+class ResolverCache {
+public:
+  typedef std::shared_ptr<const std::vector<asio::ip::tcp::endpoint>> Endpoints;
+  typedef std::function<void(const asio::error_code& ec, Endpoints endpoints)> Handler;
+
+  struct Config {
+    // How long successful and failed lookups are kept.
+    std::chrono::steady_clock::duration positive_ttl = std::chrono::seconds(60);
+    std::chrono::steady_clock::duration negative_ttl = std::chrono::seconds(5);
+
+    // An entry used within this time of its expiry is refreshed in the background.
+    std::chrono::steady_clock::duration refresh_ahead = std::chrono::seconds(10);
+
+    // Expired entries are dropped when the cache grows beyond this many names.
+    std::size_t max_entries = 1024;
+  };
+
+  struct Stats {
+    std::uint64_t hits;     // Calls answered from the cache, including failed lookups.
+    std::uint64_t lookups;  // Queries sent to the system resolver, background refreshes included.
+  };
+
+  explicit ResolverCache(asio::io_service& ios) : ResolverCache(ios, Config{}) {}
+  ResolverCache(asio::io_service& ios, const Config& config)
+      : m_ios(ios),
+        m_config(config),
+        m_resolver{ios},
+        m_no_endpoints{std::make_shared<EndpointList>()},
+        m_hits{0},
+        m_lookups{0} {}
+  ResolverCache(const ResolverCache& src) = delete;
+  ResolverCache& operator=(const ResolverCache& rhs) = delete;
+
+  // Resolves the host name and service. The handler is called with the endpoints, or with the error of the
+  // lookup.
+  void AsyncResolve(const std::string& host, const std::string& service, Handler handler) {
+    Key key{host, service};
+    auto now = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock{m_guard};
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+      if (m_entries.size() >= m_config.max_entries) Evict(now);
+      it = m_entries.emplace(key, Entry{}).first;
+    }
+
+    Entry& entry = it->second;
+    if (entry.m_expires > now) {
+      bool refresh = !entry.m_resolving && !entry.m_ec && entry.m_expires - now < m_config.refresh_ahead;
+      if (refresh) {
+        entry.m_resolving = true;
+        StartLookup(key);
+      }
+
+      asio::error_code ec = entry.m_ec;
+      Endpoints endpoints = entry.m_endpoints;
+      lock.unlock();
+
+      m_hits.fetch_add(1, std::memory_order_relaxed);
+      m_ios.post([handler, ec, endpoints]() { handler(ec, endpoints); });
+      return;
+    }
+
+    // Not cached or expired: wait for the lookup, starting it unless another caller already did.
+    entry.m_waiters.push_back(std::move(handler));
+    if (entry.m_resolving) return;
+
+    entry.m_resolving = true;
+    StartLookup(key);
+  }
+
+  Stats GetStats() const {
+    return Stats{m_hits.load(std::memory_order_relaxed), m_lookups.load(std::memory_order_relaxed)};
+  }
+
+  // Forgets all the cached results. Lookups in flight are not affected.
+  void Clear() {
+    std::unique_lock<std::mutex> lock{m_guard};
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+      if (it->second.m_resolving) {
+        it->second.m_expires = std::chrono::steady_clock::time_point{};
+        ++it;
+      } else {
+        it = m_entries.erase(it);
+      }
+    }
+  }
+
+private:
+  typedef std::pair<std::string, std::string> Key;  // Host name and service.
+  typedef std::vector<asio::ip::tcp::endpoint> EndpointList;
+
+  struct Entry {
+    Endpoints m_endpoints;
+    asio::error_code m_ec;                            // Error of the last lookup, if it failed.
+    std::chrono::steady_clock::time_point m_expires;  // The result is valid until then.
+    bool m_resolving = false;                         // A lookup is in flight.
+    std::vector<Handler> m_waiters;                   // Callers waiting for the lookup.
+  };
+
+  // Called with m_guard held: the resolver is shared by the threads calling AsyncResolve, and asio does not
+  // allow concurrent calls on it. The lookup completes through the io_service, never from this call.
+  void StartLookup(const Key& key) {
+    m_lookups.fetch_add(1, std::memory_order_relaxed);
+    asio::ip::tcp::resolver::query query{key.first, key.second};
+    m_resolver.async_resolve(query, [this, key](const asio::error_code& ec,
+                                                asio::ip::tcp::resolver::iterator it) {
+      onLookupDone(key, ec, it);
+    });
+  }
+
+  void onLookupDone(const Key& key, const asio::error_code& ec, asio::ip::tcp::resolver::iterator it) {
+    Endpoints endpoints = m_no_endpoints;
+    if (!ec) {
+      auto list = std::make_shared<EndpointList>();
+      for (asio::ip::tcp::resolver::iterator end; it != end; ++it) list->push_back(it->endpoint());
+      endpoints = list;
+    }
+
+    std::vector<Handler> waiters;
+    asio::error_code result_ec = ec;
+    {
+      std::unique_lock<std::mutex> lock{m_guard};
+      Entry& entry = m_entries[key];
+      entry.m_resolving = false;
+
+      auto now = std::chrono::steady_clock::now();
+      if (ec && !entry.m_ec && entry.m_endpoints && entry.m_expires > now) {
+        // A background refresh failed, keep serving the previous result until it expires.
+        result_ec = entry.m_ec;
+        endpoints = entry.m_endpoints;
+      } else if (ec != asio::error::operation_aborted) {
+        entry.m_ec = ec;
+        entry.m_endpoints = endpoints;
+        entry.m_expires = now + (ec ? m_config.negative_ttl : m_config.positive_ttl);
+      }
+
+      waiters.swap(entry.m_waiters);
+    }
+
+    for (auto& waiter : waiters) waiter(result_ec, endpoints);
+  }
+
+  // Drops the expired entries nobody is waiting for. Called with m_guard held.
+  void Evict(std::chrono::steady_clock::time_point now) {
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+      if (!it->second.m_resolving && it->second.m_expires <= now) {
+        it = m_entries.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+private:
+  asio::io_service& m_ios;
+  Config m_config;
+  asio::ip::tcp::resolver m_resolver;  // Only used with m_guard held.
+  Endpoints m_no_endpoints;  // Result of the failed lookups.
+
+  std::map<Key, Entry> m_entries;
+  std::mutex m_guard;
+
+  std::atomic<std::uint64_t> m_hits;
+  std::atomic<std::uint64_t> m_lookups;
+};
+
+#endif /* RESOLVER_CACHE_H */
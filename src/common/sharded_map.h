@@ -0,0 +1,84 @@
+#ifndef SHARDED_MAP_H
+#define SHARDED_MAP_H
+
+#include "recycling_allocator.h"
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+// A hash map split into independently locked shards. Threads working on keys that fall into different shards
+// never contend on the same mutex, so insert/erase/lookup scale with the number of threads instead of being
+// serialized by a single lock. Each shard lives on its own cache line to avoid false sharing between them,
+// and recycles the nodes of erased entries so that a steady insert/erase flow does not allocate.
+template <typename Key, typename Value, std::size_t NumShards = 64, typename Hash = std::hash<Key>>
+class ShardedMap {
+  static_assert(NumShards > 0 && (NumShards & (NumShards - 1)) == 0, "NumShards must be a power of two");
+
+public:
+  ShardedMap() = default;
+  ShardedMap(const ShardedMap& src) = delete;
+  ShardedMap& operator=(const ShardedMap& rhs) = delete;
+
+  // Inserts or replaces the value stored under the key.
+  void Insert(const Key& key, Value value) {
+    Shard& shard = GetShard(key);
+    std::unique_lock<std::mutex> lock{shard.m_guard};
+    shard.m_items[key] = std::move(value);
+  }
+
+  // Removes the key. Returns false if it was not present.
+  bool Erase(const Key& key) {
+    Shard& shard = GetShard(key);
+    std::unique_lock<std::mutex> lock{shard.m_guard};
+    return shard.m_items.erase(key) != 0;
+  }
+
+  // Calls `visitor` with the value stored under the key while holding the lock of its shard, so the value
+  // cannot be erased concurrently. Returns false if the key is not present.
+  template <typename Visitor>
+  bool Visit(const Key& key, Visitor visitor) {
+    Shard& shard = GetShard(key);
+    std::unique_lock<std::mutex> lock{shard.m_guard};
+
+    auto it = shard.m_items.find(key);
+    if (it == shard.m_items.end()) return false;
+
+    visitor(it->second);
+    return true;
+  }
+
+  std::size_t Size() const {
+    std::size_t size = 0;
+    for (auto& shard : m_shards) {
+      std::unique_lock<std::mutex> lock{shard.m_guard};
+      size += shard.m_items.size();
+    }
+    return size;
+  }
+
+private:
+  typedef RecyclingAllocator<std::pair<const Key, Value>> Allocator;
+
+  struct alignas(64) Shard {
+    Shard() : m_items{0, Hash{}, std::equal_to<Key>{}, Allocator{m_free_list}} {}
+
+    mutable std::mutex m_guard;
+    BlockFreeList m_free_list;  // Protected by m_guard like the map using it.
+    std::unordered_map<Key, Value, Hash, std::equal_to<Key>, Allocator> m_items;
+  };
+
+  Shard& GetShard(const Key& key) {
+    // Mix the high bits in, std::hash of an integer is usually the identity.
+    std::size_t h = Hash{}(key);
+    h ^= h >> 16;
+    return m_shards[h & (NumShards - 1)];
+  }
+
+private:
+  std::array<Shard, NumShards> m_shards;
+};
+
+#endif /* SHARDED_MAP_H */
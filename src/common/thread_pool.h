@@ -0,0 +1,101 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "bounded_queue.h"
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// A fixed number of worker threads executing tasks taken from a bounded queue. Used to run blocking or
+// CPU-heavy work away from the threads running the io_service event loops, or to serve the clients of a
+// synchronous server without a thread per connection. What happens to a task posted while the queue is full
+// is chosen by the caller, see Overflow.
+class ThreadPool {
+public:
+  enum class Overflow {
+    Reject,     // The task is not queued.
+    Block,      // The caller waits until a worker takes a task off the queue.
+    ShedOldest  // The task that has waited longest is dropped to make room.
+  };
+
+  // Snapshot of the load of the pool.
+  struct Stats {
+    std::size_t queued;      // Tasks waiting for a worker.
+    std::size_t max_queued;  // Peak of the above.
+    std::uint64_t blocked;   // Posts that had to wait for room.
+    std::uint64_t rejected;  // Tasks not queued because the queue was full.
+    std::uint64_t shed;      // Queued tasks dropped to make room for newer ones.
+  };
+
+  ThreadPool(unsigned int num_of_workers, std::size_t queue_capacity)
+      : m_tasks{queue_capacity}, m_rejected{0}, m_shed{0} {
+    assert(num_of_workers > 0);
+
+    for (unsigned int i = 0; i < num_of_workers; ++i) {
+      std::unique_ptr<std::thread> th{new std::thread{[this]() { Run(); }}};
+      m_workers.push_back(std::move(th));
+    }
+  }
+  ~ThreadPool() { Stop(); }
+  ThreadPool(const ThreadPool& src) = delete;
+  ThreadPool& operator=(const ThreadPool& rhs) = delete;
+
+  // Queue a task for execution. Returns false if it was not queued: the pool is stopped, or the queue is full
+  // and the overflow policy is Reject. A task shed from the queue is destroyed without being executed.
+  bool Post(std::function<void()> task, Overflow overflow = Overflow::Reject) {
+    switch (overflow) {
+      case Overflow::Block:
+        return m_tasks.Push(std::move(task));
+
+      case Overflow::ShedOldest: {
+        std::function<void()> oldest;
+        bool shed = false;
+        if (!m_tasks.PushShedOldest(std::move(task), oldest, shed)) return false;
+        if (shed) m_shed.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+
+      case Overflow::Reject:
+        break;
+    }
+
+    if (m_tasks.TryPush(std::move(task))) return true;
+    m_rejected.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  Stats GetStats() const {
+    return Stats{m_tasks.Size(), m_tasks.MaxSize(), m_tasks.BlockedPushes(),
+                 m_rejected.load(std::memory_order_relaxed), m_shed.load(std::memory_order_relaxed)};
+  }
+
+  // Drop the queued tasks and wait for the workers to finish the ones they are executing.
+  void Stop() {
+    m_tasks.Close();
+
+    for (auto& th : m_workers) {
+      if (th->joinable()) th->join();
+    }
+  }
+
+private:
+  void Run() {
+    std::function<void()> task;
+    while (m_tasks.Pop(task)) {
+      task();
+      task = nullptr;
+    }
+  }
+
+private:
+  BoundedQueue<std::function<void()>> m_tasks;
+  std::atomic<std::uint64_t> m_rejected;
+  std::atomic<std::uint64_t> m_shed;
+  std::vector<std::unique_ptr<std::thread>> m_workers;
+};
+
+#endif /* THREAD_POOL_H */
@@ -0,0 +1,258 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include "handler_allocator.h"
+#include <asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Hierarchical timing wheel: a single asio timer drives any number of timeouts. Time is divided into ticks
+// and the timers are kept in several levels of slots, level L having a resolution of SLOTS_PER_LEVEL^L ticks:
+// a timer is linked into the slot of the lowest level whose range covers its timeout, and moves down one
+// level whenever the level below wraps around, until it reaches level 0 where it expires. Arming and
+// cancelling a timer are O(1), every timer is moved at most NUM_LEVELS - 1 times, and a tick only looks at
+// the timers expiring at that tick, so the cost of the wheel does not grow with the number of timers armed.
+// Timeouts are rounded up to the next tick. The wheel only ticks while timers are armed.
+// The wheel can be used from multiple threads. Expired timers are called from the thread running the tick,
+// outside the wheel's lock, so they may arm or cancel timers.
+class TimerWheel {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  // A timeout that can be armed on the wheel again and again. The callback is set once, it must check on its
+  // own whether the timeout it was armed for is still relevant: a timer that is cancelled or re-armed while
+  // its expiry is being reported is still called.
+  class Timer {
+  public:
+    explicit Timer(std::function<void()> on_expired)
+        : m_on_expired{std::move(on_expired)},
+          m_prev{nullptr},
+          m_next{nullptr},
+          m_expiry{0},
+          m_slot{0},
+          m_armed{false} {}
+    Timer(const Timer& src) = delete;
+    Timer& operator=(const Timer& rhs) = delete;
+
+  private:
+    friend class TimerWheel;
+
+    std::function<void()> m_on_expired;
+    std::shared_ptr<void> m_owner;  // Kept alive while the timer is armed.
+    Timer* m_prev;                  // Links in the list of the timer's slot.
+    Timer* m_next;
+    std::uint64_t m_expiry;  // Tick the timer expires at.
+    std::size_t m_slot;      // Slot the timer is linked into, across all the levels.
+    bool m_armed;
+  };
+
+  TimerWheel(asio::io_service& ios, Clock::duration tick)
+      : m_timer{ios},
+        m_tick{tick},
+        m_origin{Clock::now()},
+        m_slots(NUM_LEVELS * SLOTS_PER_LEVEL, nullptr),
+        m_current_tick{0},
+        m_armed_count{0},
+        m_running{false},
+        m_memory{std::make_shared<HandlerMemory>()} {}
+  ~TimerWheel() {
+    // Disarm the timers still armed, releasing their owners. An owner may own its timer, so the owners are
+    // only released once all the timers have been unlinked.
+    std::vector<std::shared_ptr<void>> owners;
+    for (Timer* head : m_slots) {
+      for (Timer* timer = head; timer != nullptr; timer = timer->m_next) {
+        timer->m_armed = false;
+        owners.push_back(std::move(timer->m_owner));
+      }
+    }
+  }
+  TimerWheel(const TimerWheel& src) = delete;
+  TimerWheel& operator=(const TimerWheel& rhs) = delete;
+
+  // Arms the timer to expire at `deadline`, or re-arms it if it is already armed. `owner` is kept alive
+  // until the timer expires or is cancelled, so that the object owning the timer outlives its expiry.
+  void Arm(Timer& timer, Clock::time_point deadline, std::shared_ptr<void> owner = nullptr) {
+    std::shared_ptr<void> previous_owner;
+    std::unique_lock<std::mutex> lock{m_guard};
+
+    if (timer.m_armed) {
+      Unlink(timer);
+      previous_owner = std::move(timer.m_owner);
+    }
+
+    if (!m_running) {
+      // The wheel was idle, catch up with the current time before computing the expiry tick.
+      m_current_tick = TicksSinceOrigin(Clock::now());
+    }
+
+    std::uint64_t expiry = TicksSinceOrigin(deadline + m_tick - Clock::duration{1});
+    timer.m_expiry = expiry > m_current_tick ? expiry : m_current_tick + 1;
+    timer.m_owner = std::move(owner);
+    Link(timer);
+
+    if (!m_running) {
+      m_running = true;
+      ScheduleTick();
+    }
+  }
+
+  // Disarms the timer. Returns false if it was not armed.
+  bool Cancel(Timer& timer) {
+    std::shared_ptr<void> owner;
+    std::unique_lock<std::mutex> lock{m_guard};
+
+    if (!timer.m_armed) return false;
+
+    Unlink(timer);
+    owner = std::move(timer.m_owner);
+    return true;
+  }
+
+private:
+  static const unsigned int LEVEL_BITS = 6;
+  static const std::size_t SLOTS_PER_LEVEL = std::size_t{1} << LEVEL_BITS;
+  static const unsigned int NUM_LEVELS = 4;  // 2^24 ticks, over 46 hours with 10ms ticks.
+
+  // Links the timer into the slot of the lowest level covering its expiry. Timers beyond the range of the
+  // top level are parked at its far end and placed again when they get there.
+  void Link(Timer& timer) {
+    std::uint64_t expiry = timer.m_expiry;
+    std::uint64_t max_expiry = m_current_tick + (std::uint64_t{1} << (LEVEL_BITS * NUM_LEVELS)) - 1;
+    if (expiry > max_expiry) expiry = max_expiry;
+
+    unsigned int level = 0;
+    std::uint64_t delta = expiry - m_current_tick;
+    while (level + 1 < NUM_LEVELS && delta >= (std::uint64_t{1} << (LEVEL_BITS * (level + 1)))) ++level;
+
+    timer.m_slot = SlotOf(level, expiry);
+
+    Timer*& head = m_slots[timer.m_slot];
+    timer.m_prev = nullptr;
+    timer.m_next = head;
+    if (head != nullptr) head->m_prev = &timer;
+    head = &timer;
+
+    timer.m_armed = true;
+    ++m_armed_count;
+  }
+
+  void Unlink(Timer& timer) {
+    if (timer.m_prev != nullptr) {
+      timer.m_prev->m_next = timer.m_next;
+    } else {
+      m_slots[timer.m_slot] = timer.m_next;
+    }
+    if (timer.m_next != nullptr) timer.m_next->m_prev = timer.m_prev;
+
+    timer.m_prev = timer.m_next = nullptr;
+    timer.m_armed = false;
+    --m_armed_count;
+  }
+
+  // Moves the timers of a slot of an upper level down to the levels below.
+  void Cascade(unsigned int level) {
+    std::size_t slot = SlotOf(level, m_current_tick);
+
+    Timer* timer = m_slots[slot];
+    m_slots[slot] = nullptr;
+    while (timer != nullptr) {
+      Timer* next = timer->m_next;
+      --m_armed_count;
+      Link(*timer);
+      timer = next;
+    }
+  }
+
+  // Called with m_guard held, a single tick wait is ever in flight. The wait shares the ownership of its
+  // memory: when the wheel is destroyed first, the cancelled wait stays queued in the io_service until it is
+  // run or destroyed, and asio releases the memory of the operation then.
+  void ScheduleTick() {
+    std::shared_ptr<HandlerMemory> memory = m_memory;
+    m_timer.expires_at(m_origin + m_tick * static_cast<Clock::rep>(m_current_tick + 1));
+    m_timer.async_wait(MakeCustomAllocHandler(*memory, [this, memory](const asio::error_code& ec) {
+      if (ec != asio::error::operation_aborted) onTick();  // Once cancelled, the wheel may be gone.
+    }));
+  }
+
+  void onTick() {
+    // The expired timers are collected into the vector of the wheel, taken over by this tick: a later tick
+    // may run on another thread while the callbacks of this one are still being called.
+    std::vector<std::pair<Timer*, std::shared_ptr<void>>> expired;
+    {
+      std::unique_lock<std::mutex> lock{m_guard};
+      expired.swap(m_expired);
+
+      // Process every tick elapsed since the last one, the wait may have completed late.
+      std::uint64_t now_tick = TicksSinceOrigin(Clock::now());
+      while (m_current_tick < now_tick && m_armed_count != 0) {
+        ++m_current_tick;
+
+        // When a level wraps around, the next slot of the level above is spread over it.
+        for (unsigned int level = 1; level < NUM_LEVELS; ++level) {
+          if ((m_current_tick & ((std::uint64_t{1} << (LEVEL_BITS * level)) - 1)) != 0) break;
+          Cascade(level);
+        }
+
+        Timer* timer = m_slots[SlotOf(0, m_current_tick)];
+        while (timer != nullptr) {
+          Timer* next = timer->m_next;
+          Unlink(*timer);
+          if (timer->m_expiry <= m_current_tick) {
+            expired.emplace_back(timer, std::move(timer->m_owner));
+          } else {
+            Link(*timer);  // Parked beyond the range of the wheel.
+          }
+          timer = next;
+        }
+      }
+
+      if (m_armed_count != 0) {
+        m_current_tick = now_tick;
+        ScheduleTick();
+      } else {
+        m_running = false;
+      }
+    }
+
+    for (auto& entry : expired) entry.first->m_on_expired();
+
+    // Give the vector back, with its capacity, so that the ticks do not allocate in steady state.
+    expired.clear();
+    std::unique_lock<std::mutex> lock{m_guard};
+    if (expired.capacity() > m_expired.capacity()) m_expired.swap(expired);
+  }
+
+  // Slot of the given level covering the tick.
+  static std::size_t SlotOf(unsigned int level, std::uint64_t tick) {
+    std::uint64_t index = (tick >> (LEVEL_BITS * level)) & (SLOTS_PER_LEVEL - 1);
+    return level * SLOTS_PER_LEVEL + static_cast<std::size_t>(index);
+  }
+
+  std::uint64_t TicksSinceOrigin(Clock::time_point t) const {
+    if (t <= m_origin) return 0;
+    return static_cast<std::uint64_t>((t - m_origin) / m_tick);
+  }
+
+private:
+  asio::steady_timer m_timer;  // Fires once per tick while timers are armed.
+  Clock::duration m_tick;
+  Clock::time_point m_origin;  // Start of tick 0.
+
+  std::vector<Timer*> m_slots;   // Heads of the lists of timers, SLOTS_PER_LEVEL per level.
+  std::uint64_t m_current_tick;  // Last tick processed.
+  std::size_t m_armed_count;
+  bool m_running;  // A tick wait is in flight.
+  std::mutex m_guard;
+
+  // Spare vector for the timers expired by a tick, with their owners. Taken by the tick handler for the time
+  // it calls them, so that ticks running concurrently on several threads never share it.
+  std::vector<std::pair<Timer*, std::shared_ptr<void>>> m_expired;
+  std::shared_ptr<HandlerMemory> m_memory;  // Memory of the tick wait.
+};
+
+#endif /* TIMER_WHEEL_H */